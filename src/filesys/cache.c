@@ -0,0 +1,256 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include "filesys/inode.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The page cache holds whole pages of file data, keyed by inode
+   number and page number within the file.  File reads go through
+   it, including the VM layer's reads of executable pages, so
+   processes that start the same program soon after each other read
+   it from memory.  All writes to a file go through inode_write_at(),
+   which drops the cached pages it writes both before and after
+   writing them to disk: before, so that no reader gets the old data
+   from the cache, and after, so that a page read while the write was
+   in progress isn't kept.  Thus a page stays cached only if it was
+   read after the last write to it finished, so the cache never holds
+   stale data and never needs to write anything back.
+
+   A page is read from disk without the cache lock held, so that
+   a read from one file doesn't hold up every other cached read,
+   and so that the read can take the inode's locks.  Meanwhile the
+   page is in the cache marked as loading, and lookups of it wait
+   until it is loaded.  The free map is never cached, so writing
+   it never takes the cache lock. */
+
+/* Maximum number of pages in the page cache. */
+#define PAGE_CACHE_SIZE 64
+
+static struct cache_page slots[PAGE_CACHE_SIZE];
+static struct hash pages;               /* Slots in use, by key. */
+static size_t clock_hand;               /* Next slot to consider evicting. */
+static struct lock cache_lock;
+static struct condition loaded_cond;    /* Broadcast when a page loads. */
+
+static unsigned cache_page_hash (const struct hash_elem *, void *);
+static bool cache_page_less (const struct hash_elem *,
+                             const struct hash_elem *, void *);
+static struct cache_page *lookup (block_sector_t inumber, size_t page_idx);
+static struct cache_page *get_free_slot (void);
+
+/* Initializes the page cache. */
+void
+page_cache_init (void) 
+{
+  lock_init (&cache_lock);
+  cond_init (&loaded_cond);
+  if (!hash_init (&pages, cache_page_hash, cache_page_less, NULL))
+    PANIC ("page cache creation failed");
+}
+
+/* Returns the cached page PAGE_IDX of INODE, reading it in if it
+   is not cached yet, with its reference count raised so that it
+   stays in the cache until the caller passes it to
+   page_cache_put().  Returns a null pointer if every page in the
+   cache is in use, in which case the caller should read the data
+   without the cache. */
+struct cache_page *
+page_cache_get (struct inode *inode, size_t page_idx) 
+{
+  block_sector_t inumber = inode_get_inumber (inode);
+  struct cache_page *p;
+  bool ok;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      p = lookup (inumber, page_idx);
+      if (p != NULL)
+        {
+          p->ref_cnt++;
+          p->accessed = true;
+          while (p->loading)
+            cond_wait (&loaded_cond, &cache_lock);
+          if (!p->in_use)
+            {
+              /* The read failed or was outdated; read without the
+                 cache. */
+              p->ref_cnt--;
+              p = NULL;
+            }
+          break;
+        }
+
+      p = get_free_slot ();
+      if (p == NULL)
+        break;
+      p->inumber = inumber;
+      p->page_idx = page_idx;
+      p->in_use = true;
+      p->loading = true;
+      p->stale = false;
+      p->ref_cnt = 1;
+      p->accessed = true;
+      hash_insert (&pages, &p->hash_elem);
+
+      lock_release (&cache_lock);
+      ok = inode_read_page (inode, page_idx, p->kpage);
+      lock_acquire (&cache_lock);
+
+      p->loading = false;
+      cond_broadcast (&loaded_cond, &cache_lock);
+      if (ok && !p->stale)
+        break;
+
+      /* Give up on the page.  If it was written while it was
+         read, read it again. */
+      hash_delete (&pages, &p->hash_elem);
+      p->in_use = false;
+      p->ref_cnt--;
+      p = NULL;
+      if (!ok)
+        break;
+    }
+  lock_release (&cache_lock);
+
+  return p;
+}
+
+/* Releases a reference to P obtained from page_cache_get(). */
+void
+page_cache_put (struct cache_page *p) 
+{
+  lock_acquire (&cache_lock);
+  ASSERT (p->ref_cnt > 0);
+  p->ref_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Removes whichever pages of INODE that hold the SIZE bytes
+   starting at byte OFFSET are cached.  Called before and after
+   every write to INODE.  A page still being read is marked stale
+   instead, so that it is read again.  Holders of a removed page
+   may keep reading it until they put it. */
+void
+page_cache_invalidate (struct inode *inode, off_t offset, off_t size) 
+{
+  block_sector_t inumber = inode_get_inumber (inode);
+  size_t page_idx, last_idx;
+
+  if (size <= 0)
+    return;
+
+  last_idx = (offset + size - 1) / PGSIZE;
+  lock_acquire (&cache_lock);
+  for (page_idx = offset / PGSIZE; page_idx <= last_idx; page_idx++)
+    {
+      struct cache_page *p = lookup (inumber, page_idx);
+
+      if (p != NULL && p->loading)
+        p->stale = true;
+      else if (p != NULL)
+        {
+          hash_delete (&pages, &p->hash_elem);
+          p->in_use = false;
+        }
+    }
+  lock_release (&cache_lock);
+}
+
+/* Removes all of INODE's pages from the cache.  Called when INODE
+   is deleted, so that a new inode in the same sector does not see
+   its data.  A page still being read is dropped once it is read. */
+void
+page_cache_drop (struct inode *inode) 
+{
+  block_sector_t inumber = inode_get_inumber (inode);
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < PAGE_CACHE_SIZE; i++) 
+    {
+      struct cache_page *p = &slots[i];
+      if (p->in_use && p->inumber == inumber && p->loading)
+        p->stale = true;
+      else if (p->in_use && p->inumber == inumber) 
+        {
+          hash_delete (&pages, &p->hash_elem);
+          p->in_use = false;
+        }
+    }
+  lock_release (&cache_lock);
+}
+
+/* Returns the cached page PAGE_IDX of inode INUMBER, or a null
+   pointer if it is not cached.  The cache lock must be held. */
+static struct cache_page *
+lookup (block_sector_t inumber, size_t page_idx) 
+{
+  struct cache_page key;
+  struct hash_elem *e;
+
+  key.inumber = inumber;
+  key.page_idx = page_idx;
+  e = hash_find (&pages, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct cache_page, hash_elem) : NULL;
+}
+
+/* Returns a slot to read a new page into, evicting a page that no
+   one holds if necessary, or a null pointer if every page is held.
+   Evicts in clock order, giving pages used since the hand last
+   passed them a second chance.  The cache lock must be held. */
+static struct cache_page *
+get_free_slot (void) 
+{
+  size_t i;
+
+  for (i = 0; i < 2 * PAGE_CACHE_SIZE; i++) 
+    {
+      struct cache_page *p = &slots[clock_hand];
+      clock_hand = (clock_hand + 1) % PAGE_CACHE_SIZE;
+
+      if (p->ref_cnt > 0)
+        continue;
+      if (p->kpage == NULL) 
+        {
+          p->kpage = palloc_get_page (0);
+          if (p->kpage == NULL)
+            continue;
+          return p;
+        }
+      if (!p->in_use)
+        return p;
+      if (p->accessed)
+        {
+          p->accessed = false;
+          continue;
+        }
+
+      hash_delete (&pages, &p->hash_elem);
+      p->in_use = false;
+      return p;
+    }
+  return NULL;
+}
+
+/* Returns a hash value for page P. */
+static unsigned
+cache_page_hash (const struct hash_elem *p_, void *aux UNUSED) 
+{
+  const struct cache_page *p = hash_entry (p_, struct cache_page, hash_elem);
+  return hash_int (p->inumber) ^ hash_int (p->page_idx);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+cache_page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                 void *aux UNUSED) 
+{
+  const struct cache_page *a = hash_entry (a_, struct cache_page, hash_elem);
+  const struct cache_page *b = hash_entry (b_, struct cache_page, hash_elem);
+
+  if (a->inumber != b->inumber)
+    return a->inumber < b->inumber;
+  return a->page_idx < b->page_idx;
+}
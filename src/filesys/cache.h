@@ -0,0 +1,32 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+struct inode;
+
+/* A page of file data held in the page cache. */
+struct cache_page
+  {
+    struct hash_elem hash_elem;         /* Element in the page cache. */
+    block_sector_t inumber;             /* Inode the page belongs to. */
+    size_t page_idx;                    /* Page number within the file. */
+    void *kpage;                        /* PGSIZE bytes of file data. */
+    bool in_use;                        /* Holds a page of some file? */
+    bool loading;                       /* Being read from disk? */
+    bool stale;                         /* Written or dropped while loading? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    int ref_cnt;                        /* Holders; page can't be evicted. */
+  };
+
+void page_cache_init (void);
+struct cache_page *page_cache_get (struct inode *, size_t page_idx);
+void page_cache_put (struct cache_page *);
+void page_cache_invalidate (struct inode *, off_t offset, off_t size);
+void page_cache_drop (struct inode *);
+
+#endif /* filesys/cache.h */
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -30,6 +31,7 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  page_cache_init ();
   free_map_init ();
 
   if (format) 
@@ -43,6 +45,7 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  inode_flush_all ();
   free_map_close ();
 }
 
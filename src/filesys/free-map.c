@@ -14,6 +14,11 @@ static struct bitmap *free_map;      /* Free map, one bit per sector. */
 /* Lock for the free map. */
 static struct lock free_map_lock;
 
+/* Number of free sectors, and how many of those have been
+   promised to delayed writes by free_map_reserve(). */
+static size_t free_cnt;
+static size_t reserved_cnt;
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -24,20 +29,25 @@ free_map_init (void)
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
   lock_init (&free_map_lock);
-
+  free_cnt = bitmap_size (free_map) - 2;
+  reserved_cnt = 0;
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+/* Allocates CNT consecutive sectors, searching first from START
+   and then from the beginning of the disk, and stores the first
+   into *SECTORP.  The free map lock must be held.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
-bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+   sectors were available or if the free_map file could not be
+   written. */
+static bool
+allocate (size_t cnt, block_sector_t start, block_sector_t *sectorp)
 {
-  lock_acquire (&free_map_lock);
+  block_sector_t sector = BITMAP_ERROR;
 
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (start < bitmap_size (free_map))
+    sector = bitmap_scan_and_flip (free_map, start, cnt, false);
+  if (sector == BITMAP_ERROR && start != 0)
+    sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
   if (sector != BITMAP_ERROR
       && free_map_file != NULL
       && !bitmap_write (free_map, free_map_file))
@@ -46,10 +56,80 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
       sector = BITMAP_ERROR;
     }
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      *sectorp = sector;
+      free_cnt -= cnt;
+    }
+  return sector != BITMAP_ERROR;
+}
 
+/* Allocates CNT consecutive sectors from the free map and stores
+   the first into *SECTORP.  Sectors set aside by
+   free_map_reserve() are not available.
+   Returns true if successful, false if not enough consecutive
+   sectors were available or if the free_map file could not be
+   written. */
+bool
+free_map_allocate (size_t cnt, block_sector_t *sectorp)
+{
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (free_cnt - reserved_cnt >= cnt)
+    success = allocate (cnt, 0, sectorp);
+  lock_release (&free_map_lock);
+
+  return success;
+}
+
+/* Allocates CNT consecutive sectors out of an earlier
+   free_map_reserve(), preferring the first free run at or after
+   HINT, and stores the first into *SECTORP.
+   Returns true if successful, false if not enough consecutive
+   sectors were available or if the free_map file could not be
+   written. */
+bool
+free_map_allocate_reserved (size_t cnt, block_sector_t hint,
+                            block_sector_t *sectorp)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  success = allocate (cnt, hint, sectorp);
+  if (success)
+    reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+
+  return success;
+}
+
+/* Sets aside CNT sectors, not necessarily consecutive, to be
+   allocated later with free_map_allocate_reserved().
+   Returns true if successful, false if the disk is too full. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = free_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+
+  return success;
+}
+
+/* Gives back CNT sectors set aside by free_map_reserve() that
+   will not be allocated after all. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
   lock_release (&free_map_lock);
-  return sector != BITMAP_ERROR;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
@@ -61,6 +141,7 @@ free_map_release (block_sector_t sector, size_t cnt)
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
   bitmap_write (free_map, free_map_file);
+  free_cnt += cnt;
 
   lock_release (&free_map_lock);
 }
@@ -76,6 +157,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
 
   lock_release (&free_map_lock);
 }
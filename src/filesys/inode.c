@@ -2,83 +2,58 @@
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdint.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
+   returns the same `struct inode'.  The lock also guards the
+   inodes' open counts. */
 static struct list open_inodes;
+static struct lock open_inodes_lock;
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
+/* Writes that extend a file are not given sectors right away.
+   The new data waits in memory as delayed blocks, with space set
+   aside by free_map_reserve(), until the inode is flushed.  Then
+   all of its new sectors are allocated at once, so they can go in
+   one contiguous run, and a file removed and closed before it is
+   flushed never allocates data sectors at all. */
 
-static void
-direct_map_index (struct inode_disk *disk_inode, size_t block_index, size_t sector_number)
-{
-  disk_inode->direct[block_index] = sector_number;
-}
+/* An inode is flushed once it holds this many delayed blocks. */
+#define INODE_DELAYED_MAX 64
 
-static void
-indirect_map_index (struct inode_disk *disk_inode, size_t block_index, size_t sector_number)
-{
-  /* Find the index if the indirect blocks direct block array */
-  size_t relative_index = block_index - MAX_INDEX_DIRECT;
-  
-  struct indirect_block* ptr = malloc (sizeof (struct indirect_block));
-  block_read (fs_device, disk_inode->indirect, ptr);
-  ptr->direct[relative_index] = sector_number;
-  block_write (fs_device, disk_inode->indirect, ptr);
-  free (ptr);
-}
-
-static void 
-double_indirect_map_index (struct inode_disk *disk_inode, size_t block_index, size_t sector_number)
-{
-  /*Find the relative index */
-  size_t relative_index = block_index - MAX_INDEX_INDIRECT;
-
-  /*Determine which second level block to access - and where the data will go in that*/
-  size_t second_level_block_index = relative_index / INDIRECT_BLOCK_SECTORS;
-  size_t second_level_relative_index = relative_index % INDIRECT_BLOCK_SECTORS;
+/* All open inodes are flushed once together they hold this many
+   delayed blocks. */
+#define DELAYED_MAX 256
 
-  /* Get first level block data */
-  struct indirect_block* first_level_ptr = malloc (sizeof (struct indirect_block));
-  block_read (fs_device, disk_inode->double_indirect, first_level_ptr);
-
-  /* Get second level block data */
-  struct indirect_block* second_level_ptr = malloc (sizeof(struct indirect_block));
-  block_read (fs_device, first_level_ptr->direct[second_level_block_index], second_level_ptr);
+/* A block of file data that has no sector on disk yet. */
+struct delayed_block
+  {
+    struct hash_elem elem;              /* Element in delayed_blocks. */
+    size_t idx;                         /* Block index within file. */
+    uint8_t *data;                      /* BLOCK_SECTOR_SIZE bytes. */
+  };
 
-  /* Write index */
-  second_level_ptr->direct[second_level_relative_index] = sector_number;
+/* Number of delayed blocks held by all inodes. */
+static size_t delayed_cnt;
+static struct lock delayed_lock;
 
-  /* Write to disk and free recourses */
-  block_write (fs_device, first_level_ptr->direct[second_level_block_index], second_level_ptr);
-  block_write (fs_device, disk_inode->double_indirect, first_level_ptr);
-  free (first_level_ptr);
-  free (second_level_ptr);
-}
+static off_t read_sectors (struct inode *, void *, off_t size, off_t offset);
+static bool on_disk (struct inode *, size_t idx);
 
-static void 
-inode_map_sector_index (struct inode_disk *disk_inode, size_t block_index, size_t sector_number)
+/* Returns the number of sectors to allocate for an inode SIZE
+   bytes long. */
+static inline size_t
+bytes_to_sectors (off_t size)
 {
-  if (block_index < MAX_INDEX_DIRECT)
-    direct_map_index(disk_inode, block_index, sector_number);
-  else if (block_index < MAX_INDEX_INDIRECT)
-    indirect_map_index(disk_inode, block_index, sector_number);
-  else if (block_index < MAX_INDEX_DOUBLE_INDIRECT)
-    double_indirect_map_index(disk_inode, block_index, sector_number);
+  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-
 static size_t
 get_direct_map_index (struct inode_disk *disk_inode, size_t block_index)
 {
@@ -157,6 +132,8 @@ byte_to_sector (const struct inode *inode, off_t pos)
     return -1;
 
   block_sector_t sector_offset = pos / BLOCK_SECTOR_SIZE;
+  if (sector_offset >= inode->sector_cnt)
+    return -1;
   
   return get_inode_map_sector_index (&inode->data, sector_offset);
 }
@@ -166,188 +143,321 @@ void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  lock_init (&open_inodes_lock);
+  lock_init (&delayed_lock);
 }
 
-static size_t
-inode_grow (struct inode_disk *disk_inode, size_t sectors_to_grow, bool must_succeed)
+static unsigned
+delayed_block_hash (const struct hash_elem *e, void *aux UNUSED)
 {
-  int i;
-  int sector_index;
-  if (sectors_to_grow <= 0)
-    {
-      return 0;
-    }
-
-  static char zeros[BLOCK_SECTOR_SIZE];
-  size_t sectors_successfully_allocated = 0;
-  bool alloc_success = false;
-  size_t starting_sectors = bytes_to_sectors (disk_inode->length);
-  size_t desired_ending_sectors = starting_sectors + sectors_to_grow; 
+  const struct delayed_block *b = hash_entry (e, struct delayed_block, elem);
+  return hash_int (b->idx);
+}
 
-  /* Check how large the inode is trying to grow.
-    Allocate sectors for the file data. - we need enough for the data as well as the index blocks
-    we must calculate how many NEW index blocks are needed after we find out how many data blocks we can actually allocate*/
+static bool
+delayed_block_less (const struct hash_elem *a, const struct hash_elem *b,
+                    void *aux UNUSED)
+{
+  return (hash_entry (a, struct delayed_block, elem)->idx
+          < hash_entry (b, struct delayed_block, elem)->idx);
+}
 
-  /* Allocate the data blocks required */
-  block_sector_t *allocated_sectors = malloc (sectors_to_grow * sizeof (block_sector_t));
-  for (i = 0; i < sectors_to_grow; ++i)
-  {
-    /* Allocate this sector - if we fail, determine behavior based on must_succeed */
-    if (!free_map_allocate (1, &allocated_sectors[i]))
-      {
-        
-        /* If we must succeed and failed, we will return -1 */
-        if (must_succeed == true)
-        {
-          sectors_successfully_allocated = -1;
-          alloc_success = false;
-          goto return_result;   
-        }
+static void
+delayed_block_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  struct delayed_block *b = hash_entry (e, struct delayed_block, elem);
 
-        else
-        {
-          sectors_successfully_allocated = i;
-          break;
-        }
-      }
-      
-      /* If we didn't fail */
-      sectors_successfully_allocated++;
-  }
+  lock_acquire (&delayed_lock);
+  delayed_cnt--;
+  lock_release (&delayed_lock);
 
-  /* Initialize the data to zero. */
-  for (i = 0; i < sectors_successfully_allocated; ++i)
-  {
-    block_write (fs_device, allocated_sectors[i], zeros);
-  }
-
-  /* Determine how many indirect blocks we need - given how many we actually allocated */
-  size_t actual_ending_sectors = starting_sectors + sectors_successfully_allocated;
+  free (b->data);
+  free (b);
+}
 
-  bool need_indirect_block = ((starting_sectors < MAX_INDEX_DIRECT) && (actual_ending_sectors > MAX_INDEX_DIRECT)) ? true : false;
-  bool need_first_level_block = ((starting_sectors < MAX_INDEX_INDIRECT) && (actual_ending_sectors > MAX_INDEX_INDIRECT) ) ? true : false;
+/* Returns INODE's delayed block for block index IDX, or a null
+   pointer if there is none.  If CREATE is true, a missing block
+   is created filled with zeros, and a null pointer is returned
+   only if memory allocation fails.  INODE's grow_lock must be
+   held. */
+static struct delayed_block *
+delayed_block_lookup (struct inode *inode, size_t idx, bool create)
+{
+  struct delayed_block key;
+  struct delayed_block *b;
+  struct hash_elem *e;
+
+  key.idx = idx;
+  e = hash_find (&inode->delayed_blocks, &key.elem);
+  if (e != NULL)
+    return hash_entry (e, struct delayed_block, elem);
+  if (!create)
+    return NULL;
 
-  int starting_second_level_blocks = ((starting_sectors - MAX_INDEX_INDIRECT) / INDIRECT_BLOCK_SECTORS);
-  int ending_second_level_blocks = ((actual_ending_sectors - MAX_INDEX_INDIRECT) / INDIRECT_BLOCK_SECTORS);
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return NULL;
+  b->data = calloc (1, BLOCK_SECTOR_SIZE);
+  if (b->data == NULL)
+    {
+      free (b);
+      return NULL;
+    }
+  b->idx = idx;
+  hash_insert (&inode->delayed_blocks, &b->elem);
 
-  bool need_second_level_block = true;
+  lock_acquire (&delayed_lock);
+  delayed_cnt++;
+  lock_release (&delayed_lock);
+  return b;
+}
 
-  if (((int)(starting_sectors - MAX_INDEX_INDIRECT)) < 0)
-  {
-    need_second_level_block = false;
-  }
+/* Returns the number of index blocks needed to map SECTORS data
+   sectors. */
+static size_t
+index_sectors (size_t sectors)
+{
+  size_t cnt = 0;
+
+  if (sectors > MAX_INDEX_DIRECT)
+    cnt++;
+  if (sectors > MAX_INDEX_INDIRECT)
+    cnt += 1 + DIV_ROUND_UP (sectors - MAX_INDEX_INDIRECT,
+                             INDIRECT_BLOCK_SECTORS);
+  return cnt;
+}
 
-  size_t second_level_blocks_to_allocate = ending_second_level_blocks - starting_second_level_blocks;
+/* Allocates CNT sectors into SECTORS in as few contiguous runs as
+   the free map allows, looking first right after HINT.  If
+   RESERVED, the sectors come out of an earlier free_map_reserve().
+   Returns true if successful.  On failure, frees whatever was
+   allocated and returns false. */
+static bool
+allocate_sectors (block_sector_t *sectors, size_t cnt, block_sector_t hint,
+                  bool reserved)
+{
+  size_t done = 0;
+  size_t run = cnt;
+  size_t i;
 
-  /* Allocate index blocks required - if we fail any of these, we should quit*/
-  size_t indirect_block_index;
-  size_t first_level_block_index;
+  while (done < cnt)
+    {
+      block_sector_t first;
+      bool success;
+
+      if (run > cnt - done)
+        run = cnt - done;
+      success = (reserved
+                 ? free_map_allocate_reserved (run, hint, &first)
+                 : free_map_allocate (run, &first));
+      if (!success)
+        {
+          if (run > 1)
+            {
+              /* No run that long is free, try a shorter one. */
+              run /= 2;
+              continue;
+            }
+          for (i = 0; i < done; i++)
+            free_map_release (sectors[i], 1);
+          return false;
+        }
 
-  block_sector_t *allocated_second_level_blocks = malloc (second_level_blocks_to_allocate * sizeof (block_sector_t));
+      for (i = 0; i < run; i++)
+        sectors[done + i] = first + i;
+      done += run;
+      hint = first + run;
+    }
+  return true;
+}
 
-  /* If we now have enough to require a indirect block */
-  if (need_indirect_block)
-  {
-    if (!free_map_allocate (1, &indirect_block_index))
+/* Reads the index block at *SECTORP into BLOCK if EXISTS, or
+   otherwise starts an empty one in the next of the NEW_SECTORS
+   and stores its sector number into *SECTORP. */
+static void
+load_index_block (block_sector_t *sectorp, bool exists,
+                  struct indirect_block *block,
+                  const block_sector_t *new_sectors, size_t *next)
+{
+  if (exists)
+    block_read (fs_device, *sectorp, block);
+  else
     {
-      sectors_successfully_allocated = -1;
-      alloc_success = false;
-      goto return_result;
+      *sectorp = new_sectors[(*next)++];
+      memset (block, 0, sizeof *block);
     }
+}
 
-    /* Initialize indirect block */
-    disk_inode->indirect = indirect_block_index;
-    struct indirect_block *indirect_ptr = malloc(sizeof(struct indirect_block));
-
-    block_write (fs_device, disk_inode->indirect, indirect_ptr);
-    free (indirect_ptr);
-  }
-
-  /* If we now have enough for a double indirect block */
-  if (need_first_level_block)
-  {
-    if (!free_map_allocate (1, &first_level_block_index))
+/* Grows DISK_INODE, which has SECTOR_CNT data sectors on disk, by
+   GROW_CNT data sectors and whatever index blocks they need.  The
+   new sectors are allocated together, so that they are contiguous
+   if the free map allows it, and are filled from the blocks in
+   DELAYED where there is one and with zeros elsewhere.  If DELAYED
+   is non-null, the sectors come out of an earlier free map
+   reservation.  Writes the index blocks but not DISK_INODE.
+   Returns true if successful, false if memory or disk allocation
+   fails, in which case nothing is allocated. */
+static bool
+inode_grow (struct inode_disk *disk_inode, size_t sector_cnt,
+            size_t grow_cnt, struct hash *delayed)
+{
+  static uint8_t zeros[BLOCK_SECTOR_SIZE];
+  size_t end_cnt = sector_cnt + grow_cnt;
+  size_t index_cnt = index_sectors (end_cnt) - index_sectors (sector_cnt);
+  size_t old_second_cnt = (sector_cnt > MAX_INDEX_INDIRECT
+                           ? DIV_ROUND_UP (sector_cnt - MAX_INDEX_INDIRECT,
+                                           INDIRECT_BLOCK_SECTORS)
+                           : 0);
+  block_sector_t *sectors;
+  block_sector_t hint = 0;
+  struct indirect_block *blocks;
+  struct indirect_block *indirect, *first_level, *second_level;
+  bool have_indirect = false, have_first_level = false;
+  size_t second_idx = SIZE_MAX;
+  size_t next_index = 0;
+  size_t i;
+
+  if (grow_cnt == 0)
+    return true;
+  if (end_cnt > MAX_INDEX_DOUBLE_INDIRECT)
+    return false;
+
+  sectors = malloc ((index_cnt + grow_cnt) * sizeof *sectors);
+  blocks = malloc (3 * sizeof *blocks);
+  if (sectors == NULL || blocks == NULL)
     {
-      sectors_successfully_allocated = -1;
-      alloc_success = false;
-      goto return_result;
+      free (sectors);
+      free (blocks);
+      return false;
     }
-
-    /* Initialize double indirect block */
-    disk_inode->double_indirect = first_level_block_index;
-    struct indirect_block *double_indirect_first_level_ptr = malloc (sizeof (struct indirect_block));
-    block_write (fs_device, disk_inode->double_indirect, double_indirect_first_level_ptr);
-    free (double_indirect_first_level_ptr);
-  }
-
-  if (need_second_level_block)
-  {
-    /* Create all the new second level blocks we need */
-    for (i = 0; i < second_level_blocks_to_allocate; ++i)
+  indirect = &blocks[0];
+  first_level = &blocks[1];
+  second_level = &blocks[2];
+
+  /* Continue right after the file's last sector, if possible. */
+  if (sector_cnt > 0)
+    hint = get_inode_map_sector_index (disk_inode, sector_cnt - 1) + 1;
+  if (!allocate_sectors (sectors, index_cnt + grow_cnt, hint,
+                         delayed != NULL))
     {
-      if (!free_map_allocate (1, &allocated_second_level_blocks[i]))
-      {
-        sectors_successfully_allocated = -1;
-        alloc_success = false;
-        goto return_result;
-      }
+      free (sectors);
+      free (blocks);
+      return false;
     }
 
-    /* Map all second level indirect blocks in the first level indirect block */
+  /* The index blocks come first, then the data. */
+  for (i = sector_cnt; i < end_cnt; i++)
+    {
+      block_sector_t sector = sectors[index_cnt + i - sector_cnt];
+      struct delayed_block *b = NULL;
 
-    /* Load the double indirect first level block array from disk */ 
-    struct indirect_block* double_indirect_first_level_ptr = malloc (sizeof (struct indirect_block));
-    block_read (fs_device, disk_inode->double_indirect, double_indirect_first_level_ptr);
+      if (delayed != NULL)
+        {
+          struct delayed_block key;
+          struct hash_elem *e;
 
-    int k;
-    for (i = starting_second_level_blocks, k = 0; i < ending_second_level_blocks; ++i, ++k)
-    {
-      double_indirect_first_level_ptr->direct[i] = allocated_second_level_blocks[k];
-    }
+          key.idx = i;
+          e = hash_find (delayed, &key.elem);
+          if (e != NULL)
+            b = hash_entry (e, struct delayed_block, elem);
+        }
+      block_write (fs_device, sector, b != NULL ? b->data : zeros);
 
-    block_write (fs_device, disk_inode->double_indirect, double_indirect_first_level_ptr);
-    free (double_indirect_first_level_ptr);
+      if (i < MAX_INDEX_DIRECT)
+        disk_inode->direct[i] = sector;
+      else if (i < MAX_INDEX_INDIRECT)
+        {
+          if (!have_indirect)
+            {
+              load_index_block (&disk_inode->indirect,
+                                sector_cnt > MAX_INDEX_DIRECT, indirect,
+                                sectors, &next_index);
+              have_indirect = true;
+            }
+          indirect->direct[i - MAX_INDEX_DIRECT] = sector;
+        }
+      else
+        {
+          size_t rel = i - MAX_INDEX_INDIRECT;
+          size_t j = rel / INDIRECT_BLOCK_SECTORS;
 
-  }
+          if (!have_first_level)
+            {
+              load_index_block (&disk_inode->double_indirect,
+                                sector_cnt > MAX_INDEX_INDIRECT, first_level,
+                                sectors, &next_index);
+              have_first_level = true;
+            }
+          if (j != second_idx)
+            {
+              if (second_idx != SIZE_MAX)
+                block_write (fs_device, first_level->direct[second_idx],
+                             second_level);
+              load_index_block (&first_level->direct[j], j < old_second_cnt,
+                                second_level, sectors, &next_index);
+              second_idx = j;
+            }
+          second_level->direct[rel % INDIRECT_BLOCK_SECTORS] = sector;
+        }
+    }
+  ASSERT (next_index == index_cnt);
+
+  /* Write back the index blocks we changed. */
+  if (have_indirect)
+    block_write (fs_device, disk_inode->indirect, indirect);
+  if (second_idx != SIZE_MAX)
+    block_write (fs_device, first_level->direct[second_idx], second_level);
+  if (have_first_level)
+    block_write (fs_device, disk_inode->double_indirect, first_level);
+
+  free (sectors);
+  free (blocks);
+  return true;
+}
 
-  /* Add the references to allocated blocks in disk_inode's direct/index blocks 
-  start at the sector after the last pre-existing one */
-  int j;
-  for (i = starting_sectors, j = 0; i < actual_ending_sectors; ++i, ++j)
-  {
-    inode_map_sector_index (disk_inode, i, allocated_sectors[j]);
-  }
+/* Releases the data and index sectors of INODE. */
+static void
+inode_release_sectors (struct inode *inode)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  size_t cnt = inode->sector_cnt;
+  struct indirect_block *block, *second_level;
+  size_t i, j;
+
+  for (i = 0; i < cnt && i < MAX_INDEX_DIRECT; i++)
+    free_map_release (disk_inode->direct[i], 1);
+  if (cnt <= MAX_INDEX_DIRECT)
+    return;
 
-  alloc_success = true;
+  block = malloc (sizeof *block);
+  second_level = malloc (sizeof *second_level);
+  if (block == NULL || second_level == NULL)
+    PANIC ("inode %u: out of memory releasing sectors", inode->sector);
 
-  /* Free recourses and return */
-  return_result:
+  block_read (fs_device, disk_inode->indirect, block);
+  for (i = MAX_INDEX_DIRECT; i < cnt && i < MAX_INDEX_INDIRECT; i++)
+    free_map_release (block->direct[i - MAX_INDEX_DIRECT], 1);
+  free_map_release (disk_inode->indirect, 1);
 
-  /*If for any reason the allocation failed, free all allocated sectors */
-  if (!alloc_success)
+  if (cnt > MAX_INDEX_INDIRECT)
     {
-      /* Free the index blocks */
-      free_map_release (indirect_block_index, 1);
-      free_map_release (first_level_block_index, 1);
-
-      for (i = 0; i < second_level_blocks_to_allocate; ++i)
-      {
-        free_map_release (allocated_second_level_blocks[i], 1);
-      }
-  
-    /* Free the data blocks */
-      for(i = 0; i < sectors_successfully_allocated; ++i)
+      block_read (fs_device, disk_inode->double_indirect, block);
+      for (j = 0; MAX_INDEX_INDIRECT + j * INDIRECT_BLOCK_SECTORS < cnt; j++)
         {
-          free_map_release (allocated_sectors[i], 1);
+          block_read (fs_device, block->direct[j], second_level);
+          for (i = 0; i < INDIRECT_BLOCK_SECTORS; i++)
+            {
+              if (MAX_INDEX_INDIRECT + j * INDIRECT_BLOCK_SECTORS + i >= cnt)
+                break;
+              free_map_release (second_level->direct[i], 1);
+            }
+          free_map_release (block->direct[j], 1);
         }
+      free_map_release (disk_inode->double_indirect, 1);
     }
-  
-  /* Always free the temporary arrays */
-  free (allocated_second_level_blocks);
-  free (allocated_sectors);
-
-  return sectors_successfully_allocated;
 
+  free (block);
+  free (second_level);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -376,13 +486,8 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
     disk_inode->is_dir = is_dir;
 
     /*Grow the file to the size specified - fills new sectors with zero's and maps all indicies */
-    size_t result = inode_grow (disk_inode, sectors, true);
-
-    /* Allocation failed - free resources*/
-    if (result == -1)
-      {
-        goto return_result;
-      }    
+    if (!inode_grow (disk_inode, 0, sectors, NULL))
+      goto return_result;
     disk_inode->length = length;
     /* File is successfully created if we made it through */
     success = true;
@@ -406,6 +511,8 @@ inode_open (block_sector_t sector)
   struct list_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
   for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
        e = list_next (e)) 
@@ -413,15 +520,21 @@ inode_open (block_sector_t sector)
       inode = list_entry (e, struct inode, elem);
       if (inode->sector == sector) 
         {
-          inode_reopen (inode);
+          inode->open_cnt++;
+          lock_release (&open_inodes_lock);
           return inode; 
         }
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
-  if (inode == NULL)
-    return NULL;
+  if (inode == NULL || !hash_init (&inode->delayed_blocks, delayed_block_hash,
+                                   delayed_block_less, NULL))
+    {
+      free (inode);
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
   list_push_front (&open_inodes, &inode->elem);
@@ -431,8 +544,12 @@ inode_open (block_sector_t sector)
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->dirty = false;
+  inode->reserved_cnt = 0;
 
   block_read (fs_device, inode->sector, &inode->data);
+  inode->sector_cnt = bytes_to_sectors (inode->data.length);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -441,7 +558,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -452,35 +573,40 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
-/* Closes INODE and writes it to disk. (Does it?  Check code.)
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+/* Closes INODE.
+   If this was the last reference to INODE, flushes it to disk and
+   frees its memory.
+   If INODE was also a removed inode, frees its blocks instead of
+   flushing it. */
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    list_remove (&inode->elem);
+  lock_release (&open_inodes_lock);
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
+      /* Deallocate blocks if removed.  Its delayed blocks are
+         simply dropped. */
       if (inode->removed) 
         {
+          page_cache_drop (inode);
+          free_map_unreserve (inode->reserved_cnt);
+          inode_release_sectors (inode);
           free_map_release (inode->sector, 1);
-
-          int i = 0;
-          block_sector_t sector;
-          if ((sector = byte_to_sector (inode, i)) != -1)
-            {
-              i += BLOCK_SECTOR_SIZE;
-              free_map_release (sector, 1);
-            }
         }
+      else
+        inode_flush (inode);
+      hash_destroy (&inode->delayed_blocks, delayed_block_destroy);
       free (inode); 
     }
 }
@@ -494,11 +620,251 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Allocates sectors for all of INODE's delayed blocks and writes
+   them, and INODE itself if it changed, to disk.  A removed inode
+   is flushed too, since its openers may still use it; its sectors
+   are freed when it is closed for the last time.  INODE's
+   grow_lock must be held. */
+static void
+flush_locked (struct inode *inode)
+{
+  size_t data_cnt = bytes_to_sectors (inode->data.length);
+
+  if (data_cnt > inode->sector_cnt)
+    {
+      /* The reservation guarantees that there is room. */
+      if (!inode_grow (&inode->data, inode->sector_cnt,
+                       data_cnt - inode->sector_cnt, &inode->delayed_blocks))
+        PANIC ("inode %u: can't allocate reserved sectors", inode->sector);
+      hash_clear (&inode->delayed_blocks, delayed_block_destroy);
+      inode->sector_cnt = data_cnt;
+      inode->reserved_cnt = 0;
+      inode->dirty = true;
+    }
+  if (inode->dirty)
+    {
+      block_write (fs_device, inode->sector, &inode->data);
+      inode->dirty = false;
+    }
+}
+
+/* Writes INODE's delayed blocks and the inode itself to disk. */
+void
+inode_flush (struct inode *inode)
+{
+  lock_acquire (&inode->grow_lock);
+  flush_locked (inode);
+  lock_release (&inode->grow_lock);
+}
+
+/* Flushes every open inode.  Each one is reopened while the list
+   is copied, so that it isn't freed before it is flushed, and the
+   flushes happen without open_inodes_lock held, so that they don't
+   hold up inode_open() and inode_close().  If there is no memory for
+   the copy, nothing is flushed; each inode is still flushed once it
+   holds INODE_DELAYED_MAX delayed blocks. */
+void
+inode_flush_all (void)
+{
+  struct inode **inodes;
+  struct list_elem *e;
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&open_inodes_lock);
+  inodes = malloc (list_size (&open_inodes) * sizeof *inodes);
+  if (inodes != NULL)
+    for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
+         e = list_next (e))
+      {
+        struct inode *inode = list_entry (e, struct inode, elem);
+        inode->open_cnt++;
+        inodes[cnt++] = inode;
+      }
+  lock_release (&open_inodes_lock);
+
+  for (i = 0; i < cnt; i++)
+    {
+      inode_flush (inodes[i]);
+      inode_close (inodes[i]);
+    }
+  free (inodes);
+}
+
+/* Reserves free map space for INODE to grow to LENGTH bytes.
+   INODE's grow_lock must be held.
+   Returns true if successful, false if the disk is too full. */
+static bool
+reserve (struct inode *inode, off_t length)
+{
+  size_t old_cnt = bytes_to_sectors (inode->data.length);
+  size_t new_cnt = bytes_to_sectors (length);
+  size_t cnt;
+
+  if (new_cnt > MAX_INDEX_DOUBLE_INDIRECT)
+    return false;
+  cnt = (new_cnt + index_sectors (new_cnt)
+         - old_cnt - index_sectors (old_cnt));
+  if (cnt > 0 && !free_map_reserve (cnt))
+    return false;
+  inode->reserved_cnt += cnt;
+  return true;
+}
+
+/* If block IDX of INODE has no sector on disk yet, copies
+   CHUNK_SIZE bytes of it starting at SECTOR_OFS into BUFFER and
+   returns true.  Otherwise returns false without copying, and the
+   caller should read the block from disk. */
+static bool
+delayed_read (struct inode *inode, size_t idx, void *buffer,
+              int sector_ofs, int chunk_size)
+{
+  bool delayed;
+
+  lock_acquire (&inode->grow_lock);
+  delayed = idx >= inode->sector_cnt;
+  if (delayed)
+    {
+      struct delayed_block *b = delayed_block_lookup (inode, idx, false);
+      if (b != NULL)
+        memcpy (buffer, b->data + sector_ofs, chunk_size);
+      else
+        memset (buffer, 0, chunk_size);
+    }
+  lock_release (&inode->grow_lock);
+
+  return delayed;
+}
+
+/* If block IDX of INODE has no sector on disk yet, copies
+   CHUNK_SIZE bytes from BUFFER into it starting at SECTOR_OFS and
+   returns true.  Otherwise returns false without copying, and the
+   caller should write the block to disk. */
+static bool
+delayed_write (struct inode *inode, size_t idx, const void *buffer,
+               int sector_ofs, int chunk_size)
+{
+  bool delayed;
+
+  lock_acquire (&inode->grow_lock);
+  delayed = idx >= inode->sector_cnt;
+  if (delayed)
+    {
+      struct delayed_block *b = delayed_block_lookup (inode, idx, true);
+      if (b != NULL)
+        memcpy (b->data + sector_ofs, buffer, chunk_size);
+      else
+        {
+          /* Out of memory: give the block its sector now. */
+          flush_locked (inode);
+          delayed = false;
+        }
+    }
+  lock_release (&inode->grow_lock);
+
+  return delayed;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+{
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+
+  while (size > 0) 
+    {
+      /* Starting byte offset within page. */
+      int page_ofs = offset % PGSIZE;
+
+      /* Bytes left in inode, bytes left in page, lesser of the two. */
+      off_t inode_left = inode_length (inode) - offset;
+      int page_left = PGSIZE - page_ofs;
+      int min_left = inode_left < page_left ? inode_left : page_left;
+
+      /* Number of bytes to actually copy out of this page. */
+      int chunk_size = size < min_left ? size : min_left;
+      struct cache_page *p;
+      if (chunk_size <= 0)
+        break;
+
+      /* The free map is not cached: see cache.c. */
+      p = NULL;
+      if (inode->sector != FREE_MAP_SECTOR)
+        p = page_cache_get (inode, offset / PGSIZE);
+      if (p != NULL)
+        {
+          memcpy (buffer + bytes_read, (uint8_t *) p->kpage + page_ofs,
+                  chunk_size);
+          page_cache_put (p);
+        }
+      else if (read_sectors (inode, buffer + bytes_read, chunk_size, offset)
+               != chunk_size)
+        break;
+
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+
+  return bytes_read;
+}
+
+/* Reads page PAGE_IDX of INODE into KPAGE for the page cache,
+   filling the part past end of file with zeros.
+   Returns true if successful, false if memory allocation fails. */
+bool
+inode_read_page (struct inode *inode, size_t page_idx, void *kpage) 
+{
+  off_t offset = (off_t) page_idx * PGSIZE;
+  off_t inode_left = inode_length (inode) - offset;
+  off_t size = inode_left < PGSIZE ? inode_left : PGSIZE;
+  off_t bytes_read;
+
+  if (size < 0)
+    size = 0;
+  bytes_read = read_sectors (inode, kpage, size, offset);
+  memset ((uint8_t *) kpage + bytes_read, 0, PGSIZE - bytes_read);
+  return bytes_read == size;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+   OFFSET, bypassing the page cache.  For data that is read once,
+   such as pages about to be copied into frames, this does one disk
+   transfer per run of contiguous sectors instead of one per page.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached. */
+off_t
+inode_read_uncached (struct inode *inode, void *buffer, off_t size,
+                     off_t offset) 
+{
+  return read_sectors (inode, buffer, size, offset);
+}
+
+/* Returns true if block IDX of INODE has a sector on disk, false
+   if it is a delayed block. */
+static bool
+on_disk (struct inode *inode, size_t idx)
+{
+  bool result;
+
+  lock_acquire (&inode->grow_lock);
+  result = idx < inode->sector_cnt;
+  lock_release (&inode->grow_lock);
+  return result;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+   OFFSET, from the disk and the delayed blocks, bypassing the page
+   cache.  Whole sectors that are contiguous on disk are read with
+   a single transfer.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached. */
+static off_t
+read_sectors (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
@@ -507,7 +873,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
 
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
@@ -521,10 +887,29 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
+      if (delayed_read (inode, offset / BLOCK_SECTOR_SIZE,
+                        buffer + bytes_read, sector_ofs, chunk_size))
+        goto advance;
+      sector_idx = byte_to_sector (inode, offset);
+
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Read full sectors directly into caller's buffer, as
+             many at once as follow each other on disk. */
+          block_sector_t cnt = 1;
+          off_t next = offset + BLOCK_SECTOR_SIZE;
+
+          while (size - (off_t) (cnt * BLOCK_SECTOR_SIZE) >= BLOCK_SECTOR_SIZE
+                 && inode_length (inode) - next >= BLOCK_SECTOR_SIZE
+                 && on_disk (inode, next / BLOCK_SECTOR_SIZE)
+                 && byte_to_sector (inode, next) == sector_idx + cnt)
+            {
+              cnt++;
+              next += BLOCK_SECTOR_SIZE;
+            }
+          block_read_multiple (fs_device, sector_idx, cnt,
+                               buffer + bytes_read);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
       else 
         {
@@ -541,6 +926,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
         }
       
       /* Advance. */
+    advance:
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
@@ -550,41 +936,11 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   return bytes_read;
 }
 
-/* Helper function to determine how many sectors a file needs to grow have size bytes written at offset */
-static size_t 
-sectors_needed_to_grow (size_t file_len, off_t offset, off_t size)
-{
-  size_t allocated_sectors = file_len / BLOCK_SECTOR_SIZE + 1;
-
-  if ((file_len % BLOCK_SECTOR_SIZE) == 0)
-    {
-      --allocated_sectors;
-    }
-  
-  if(file_len == 0)
-  {
-    allocated_sectors = 0;
-  }
-
-  size_t allocated_bytes = allocated_sectors * BLOCK_SECTOR_SIZE;
-
-  int bytes_to_grow = (size + offset) - allocated_bytes;
-
-  int sectors_to_grow = 0;
-
-  if (bytes_to_grow > 0)
-  {
-    sectors_to_grow = bytes_to_sectors(bytes_to_grow);
-  }
-
-  return (sectors_to_grow > 0) ? sectors_to_grow : 0; 
-}
-
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   A write past end of file extends the inode, but the new data
+   only gets sectors on disk when the inode is flushed. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
@@ -598,33 +954,24 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     return 0;
   }
   
+  /* Do we need to grow the file?  If there is no room for all of
+     the new data, write only what fits in the current length. */
   lock_acquire (&inode->grow_lock);
-  
-  /* Do we need to grow the file */
-  size_t sectors_to_grow = sectors_needed_to_grow (inode_length(inode), offset, size);
-  size_t sectors_grown = inode_grow (&inode->data, sectors_to_grow, false);
-
-  size_t temp_len;
-
-  if (sectors_grown < sectors_to_grow)
+  if (offset + size > inode->data.length && reserve (inode, offset + size))
     {
-      inode->data.length += (sectors_grown * BLOCK_SECTOR_SIZE);
+      inode->data.length = offset + size;
+      inode->dirty = true;
     }
-  else
-    {
-      if (inode->data.length < (offset + size))
-        {
-          inode->data.length = offset + size;
-        }
-    }
-    
   lock_release (&inode->grow_lock);    
-  block_write (fs_device, inode->sector, &inode->data);
+
+  /* Keep readers from getting the old data from the page cache. */
+  if (inode->sector != FREE_MAP_SECTOR)
+    page_cache_invalidate (inode, offset, size);
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
 
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
@@ -638,6 +985,11 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
+      if (delayed_write (inode, offset / BLOCK_SECTOR_SIZE,
+                         buffer + bytes_written, sector_ofs, chunk_size))
+        goto advance;
+      sector_idx = byte_to_sector (inode, offset);
+
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
           /* Write full sector directly to disk. */
@@ -665,12 +1017,24 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
         }
 
       /* Advance. */
+    advance:
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
   free (bounce);
 
+  /* Drop any page read from disk while it was being written. */
+  if (inode->sector != FREE_MAP_SECTOR)
+    page_cache_invalidate (inode, offset - bytes_written, bytes_written);
+
+  /* Bound the memory held by delayed blocks. */
+  if (hash_size (&inode->delayed_blocks) >= INODE_DELAYED_MAX)
+    inode_flush (inode);
+  else if (hash_size (&inode->delayed_blocks) > 0
+           && delayed_cnt >= DELAYED_MAX)
+    inode_flush_all ();
+
   return bytes_written;
 }
 
@@ -5,6 +5,7 @@
 #include "filesys/off_t.h"
 #include "devices/block.h"
 #include "threads/synch.h"
+#include <hash.h>
 #include <list.h>
 
 /* Identifies an inode. */
@@ -53,6 +54,10 @@ struct inode
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+    bool dirty;                         /* DATA differs from the disk copy? */
+    size_t sector_cnt;                  /* Data sectors allocated on disk. */
+    size_t reserved_cnt;                /* Free map sectors reserved. */
+    struct hash delayed_blocks;         /* Data not yet allocated on disk. */
     struct lock grow_lock;              /* Lock for file grow operation. */
     struct lock dir_lock;               /* Lock for directory operation. */
   };
@@ -64,7 +69,11 @@ struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+void inode_flush (struct inode *);
+void inode_flush_all (void);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+bool inode_read_page (struct inode *, size_t page_idx, void *);
+off_t inode_read_uncached (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
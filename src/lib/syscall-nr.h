@@ -28,7 +28,13 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Benchmarks. */
+    SYS_TICKS,                  /* Timer ticks since the OS booted. */
+
+    /* Copy-on-write process creation, with VM. */
+    SYS_FORK                    /* Duplicate this process. */
   };
 
 #endif /* lib/syscall-nr.h */
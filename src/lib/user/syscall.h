@@ -45,4 +45,10 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Benchmarks. */
+long ticks (void);
+
+/* Copy-on-write process creation, with VM. */
+pid_t fork (void);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,49 @@
+/* Measures how the cost of looking up names in a directory grows
+   with the number of entries in it. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define LOOKUP_CNT 64
+
+void
+test_main (void) 
+{
+  static const int sizes[] = {16, 64, 256};
+  struct bench_timer t;
+  char name[32], bench_name[32];
+  int entry_cnt = 0;
+  size_t i;
+  int j;
+
+  CHECK (mkdir ("big"), "mkdir \"big\"");
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++) 
+    {
+      msg ("growing \"big\" to %d entries", sizes[i]);
+      for (; entry_cnt < sizes[i]; entry_cnt++) 
+        {
+          snprintf (name, sizeof name, "big/file%d", entry_cnt);
+          if (!create (name, 0))
+            fail ("create \"%s\" failed", name);
+        }
+
+      bench_start (&t);
+      for (j = 0; j < LOOKUP_CNT; j++) 
+        {
+          int fd;
+
+          snprintf (name, sizeof name, "big/file%lu",
+                    random_ulong () % entry_cnt);
+          fd = open (name);
+          if (fd < 2)
+            fail ("open \"%s\" failed", name);
+          close (fd);
+        }
+      snprintf (bench_name, sizeof bench_name, "lookup-%d", entry_cnt);
+      bench_stop (&t, bench_name, LOOKUP_CNT, "ops");
+    }
+}
@@ -0,0 +1,51 @@
+/* Measures the cost of path name lookup by opening a file in the
+   root directory and one DEPTH directories down, repeatedly. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DEPTH 8
+#define OPEN_CNT 128
+
+/* Opens and closes FILE_NAME OPEN_CNT times and reports it as
+   benchmark NAME. */
+static void
+open_ops (const char *file_name, const char *name) 
+{
+  struct bench_timer t;
+  int i;
+
+  bench_start (&t);
+  for (i = 0; i < OPEN_CNT; i++) 
+    {
+      int fd = open (file_name);
+      if (fd < 2)
+        fail ("open \"%s\" failed", file_name);
+      close (fd);
+    }
+  bench_stop (&t, name, OPEN_CNT, "ops");
+}
+
+void
+test_main (void) 
+{
+  char path[DEPTH * 3 + 8];
+  int i;
+
+  path[0] = '\0';
+  for (i = 0; i < DEPTH; i++) 
+    {
+      strlcat (path, "/d", sizeof path);
+      if (!mkdir (path))
+        fail ("mkdir \"%s\" failed", path);
+    }
+  strlcat (path, "/file", sizeof path);
+  CHECK (create (path, 0), "create \"%s\"", path);
+  CHECK (create ("/file", 0), "create \"/file\"");
+
+  open_ops ("/file", "lookup-depth-1");
+  open_ops (path, "lookup-depth-9");
+}
@@ -0,0 +1,60 @@
+/* Measures how many files per second can be created and removed,
+   and how many directories per second can be made and removed,
+   all in the root directory. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 64
+#define DIR_CNT 32
+
+void
+test_main (void) 
+{
+  struct bench_timer t;
+  char name[16];
+  int i;
+
+  msg ("creating %d files", FILE_CNT);
+  bench_start (&t);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+  bench_stop (&t, "create", FILE_CNT, "ops");
+
+  msg ("removing %d files", FILE_CNT);
+  bench_start (&t);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+  bench_stop (&t, "unlink", FILE_CNT, "ops");
+
+  msg ("making %d directories", DIR_CNT);
+  bench_start (&t);
+  for (i = 0; i < DIR_CNT; i++) 
+    {
+      snprintf (name, sizeof name, "dir%d", i);
+      if (!mkdir (name))
+        fail ("mkdir \"%s\" failed", name);
+    }
+  bench_stop (&t, "mkdir", DIR_CNT, "ops");
+
+  msg ("removing %d directories", DIR_CNT);
+  bench_start (&t);
+  for (i = 0; i < DIR_CNT; i++) 
+    {
+      snprintf (name, sizeof name, "dir%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+  bench_stop (&t, "rmdir", DIR_CNT, "ops");
+}
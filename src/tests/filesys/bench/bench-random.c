@@ -0,0 +1,54 @@
+/* Measures random read and write rates, in operations per second,
+   for 512-byte and 4 kB requests at block-aligned offsets in a
+   256 kB file. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (256 * 1024)
+#define OP_CNT 256
+
+static char buf[4096];
+
+/* Does OP_CNT random reads or writes of SIZE bytes each on FD and
+   reports them as benchmark NAME. */
+static void
+random_ops (int fd, const char *name, size_t size, bool writing) 
+{
+  struct bench_timer t;
+  int i;
+
+  bench_start (&t);
+  for (i = 0; i < OP_CNT; i++) 
+    {
+      size_t ofs = random_ulong () % (FILE_SIZE / size) * size;
+
+      seek (fd, ofs);
+      if (writing ? write (fd, buf, size) != (int) size
+          : read (fd, buf, size) != (int) size)
+        fail ("%s %zu bytes at offset %zu failed",
+              writing ? "write" : "read", size, ofs);
+    }
+  bench_stop (&t, name, OP_CNT, "ops");
+}
+
+void
+test_main (void) 
+{
+  const char *file_name = "random";
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, FILE_SIZE), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  random_ops (fd, "rand-read-512", 512, false);
+  random_ops (fd, "rand-read-4k", 4096, false);
+  random_ops (fd, "rand-write-512", 512, true);
+  random_ops (fd, "rand-write-4k", 4096, true);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,44 @@
+/* Measures sequential write and read throughput on a 512 kB file,
+   4 kB at a time.  The write time includes closing the file, so
+   that any data the file system holds back is written too. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (512 * 1024)
+#define BLOCK_SIZE 4096
+
+static char buf[BLOCK_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "seq";
+  struct bench_timer t;
+  size_t ofs;
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  bench_start (&t);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("write %d bytes at offset %zu in \"%s\" failed",
+            BLOCK_SIZE, ofs, file_name);
+  close (fd);
+  bench_stop (&t, "seq-write", FILE_SIZE, "bytes");
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  bench_start (&t);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    if (read (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("read %d bytes at offset %zu in \"%s\" failed",
+            BLOCK_SIZE, ofs, file_name);
+  bench_stop (&t, "seq-read", FILE_SIZE, "bytes");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
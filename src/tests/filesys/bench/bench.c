@@ -0,0 +1,34 @@
+#include "tests/filesys/bench/bench.h"
+#include <syscall.h>
+#include "tests/lib.h"
+
+/* Reads the time stamp counter. */
+static inline uint64_t
+rdtsc (void) 
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* Starts timing an interval. */
+void
+bench_start (struct bench_timer *t) 
+{
+  t->ticks = ticks ();
+  t->cycles = rdtsc ();
+}
+
+/* Ends the interval started by T, in which COUNT UNITs of work,
+   e.g. bytes or operations, were done, and logs it as benchmark
+   NAME in the format that bench.pm parses. */
+void
+bench_stop (const struct bench_timer *t, const char *name,
+            long count, const char *unit) 
+{
+  uint64_t cycles = rdtsc () - t->cycles;
+  long elapsed = ticks () - t->ticks;
+
+  msg ("bench %s count=%ld unit=%s ticks=%ld cycles=%llu",
+       name, count, unit, elapsed, cycles);
+}
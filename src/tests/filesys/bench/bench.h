@@ -0,0 +1,18 @@
+#ifndef TESTS_FILESYS_BENCH_BENCH_H
+#define TESTS_FILESYS_BENCH_BENCH_H
+
+#include <stdint.h>
+
+/* The start of an interval being timed, in timer ticks and in
+   time stamp counter cycles. */
+struct bench_timer
+  {
+    long ticks;
+    uint64_t cycles;
+  };
+
+void bench_start (struct bench_timer *);
+void bench_stop (const struct bench_timer *, const char *name,
+                 long count, const char *unit);
+
+#endif /* tests/filesys/bench/bench.h */
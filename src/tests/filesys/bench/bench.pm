@@ -0,0 +1,68 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Timer interrupts per second; see devices/timer.h.
+our ($TIMER_FREQ) = 100;
+
+# check_bench(@names)
+#
+# Checks that the test ran to completion and logged each benchmark
+# in @names, then writes one line per benchmark to $test.bench, as
+#
+#	TEST NAME COUNT UNIT TICKS CYCLES RATE
+#
+# where RATE is COUNT per second, in MB/s if UNIT is "bytes".  The
+# rate is computed from the TSC cycle count, which is converted to
+# seconds using the ratio of cycles to timer ticks over the whole
+# run, so that short intervals still get a useful rate.
+sub check_bench {
+    my (@names) = @_;
+    our ($test);
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+    @output = get_core_output ("run", @output);
+
+    my ($prog) = $test =~ m%([^/]+)$%;
+    fail "First line of output is not `($prog) begin' message.\n"
+      if $output[0] ne "($prog) begin";
+    fail "Output missing `($prog) end' message.\n"
+      if !grep ($_ eq "($prog) end", @output);
+
+    my (%bench, @order);
+    my ($total_ticks, $total_cycles) = (0, 0);
+    foreach (@output) {
+	my ($name, $count, $unit, $ticks, $cycles)
+	  = /^\(\Q$prog\E\) bench (\S+) count=(\d+) unit=(\S+) ticks=(\d+) cycles=(\d+)$/
+	    or next;
+	push (@order, $name) if !exists $bench{$name};
+	$bench{$name} = [$count, $unit, $ticks, $cycles];
+	$total_ticks += $ticks;
+	$total_cycles += $cycles;
+    }
+    foreach my $name (@names) {
+	fail "Output missing result for benchmark \"$name\".\n"
+	  if !exists $bench{$name};
+    }
+
+    my ($bench_fn) = "$test.bench";
+    open (BENCH, '>', $bench_fn) or die "$bench_fn: create: $!\n";
+    foreach my $name (@order) {
+	my ($count, $unit, $ticks, $cycles) = @{$bench{$name}};
+	my ($seconds);
+	if ($total_ticks > 0 && $total_cycles > 0) {
+	    $seconds = $cycles * $total_ticks / $total_cycles / $TIMER_FREQ;
+	} else {
+	    $seconds = $ticks / $TIMER_FREQ;
+	}
+	my ($rate) = $seconds > 0 ? $count / $seconds : 0;
+	$rate /= 1024 * 1024 if $unit eq 'bytes';
+	printf BENCH "%s %s %d %s %d %d %.2f\n",
+	  $test, $name, $count, $unit, $ticks, $cycles, $rate;
+    }
+    close (BENCH);
+    pass;
+}
+
+1;
@@ -0,0 +1,47 @@
+/* Forks a child that writes its copy of a data buffer, and
+   verifies that each process sees only its own writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static char buf[SIZE];
+
+/* Returns true if every byte of BUF is C. */
+static bool
+all (char c)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != c)
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+
+  memset (buf, 'p', sizeof buf);
+  child = fork ();
+  if (child == 0)
+    {
+      CHECK (all ('p'), "child sees parent's data");
+      memset (buf, 'c', sizeof buf);
+      CHECK (all ('c'), "child sees its own writes");
+      exit (81);
+    }
+
+  quiet = true;
+  CHECK (child > 0, "fork");
+  CHECK (wait (child) == 81, "wait for child");
+  quiet = false;
+  CHECK (all ('p'), "parent's data unchanged");
+  memset (buf, 'q', sizeof buf);
+  CHECK (all ('q'), "parent sees its own writes");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-cow) begin
+(fork-cow) child sees parent's data
+(fork-cow) child sees its own writes
+fork-cow: exit(81)
+(fork-cow) parent's data unchanged
+(fork-cow) parent sees its own writes
+(fork-cow) end
+fork-cow: exit(0)
+EOF
+pass;
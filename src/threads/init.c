@@ -37,6 +37,12 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -59,6 +65,7 @@ static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
 static void paging_init (void);
+static bool cpu_has_pse (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -125,6 +132,12 @@ main (void)
   ide_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
+#endif
+#ifdef VM
+  /* Initialize virtual memory. */
+  frame_table_init ();
+  swap_table_init ();
+  zswap_init ();
 #endif
   printf ("Boot complete.\n");
   
@@ -149,16 +162,23 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
-/* Populates the base page directory and page table with the
+/* Populates the base page directory and page tables with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU has page size extensions, every whole 4 MB of
+   physical memory that holds none of the kernel's code is mapped
+   with a single 4 MB page, which takes one TLB entry instead of
+   1,024.  The rest is mapped with page tables, so that the
+   kernel's code can be read-only. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  bool pse = cpu_has_pse ();
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -172,6 +192,15 @@ paging_init (void)
 
       if (pd[pde_idx] == 0)
         {
+          size_t large_pages = PTSPAN / PGSIZE;
+
+          if (pse && pte_idx == 0 && page + large_pages <= init_ram_pages
+              && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+            {
+              pd[pde_idx] = pde_create_large_kernel (vaddr, true);
+              page += large_pages - 1;
+              continue;
+            }
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
@@ -179,6 +208,15 @@ paging_init (void)
       pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
     }
 
+  /* Turn on 4 MB pages before they are used.  See [IA32-v3a] 2.5
+     "Control Registers". */
+  if (pse)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE));
+    }
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -187,6 +225,19 @@ paging_init (void)
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
 }
 
+/* Returns true if the CPU supports 4 MB pages, according to
+   the CPUID instruction.  See [IA32-v2a] "CPUID--CPU
+   Identification". */
+static bool
+cpu_has_pse (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm volatile ("cpuid"
+                : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & (1 << 3)) != 0;
+}
+
 /* Breaks the kernel command line into words and returns them as
    an argv-like array. */
 static char **
@@ -258,6 +309,14 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-sl"))
+        stack_page_limit = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        zswap_page_limit = atoi (value);
+      else if (!strcmp (name, "-fa"))
+        fault_around_pages = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -380,6 +439,11 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -sl=COUNT          Limit each process's stack to COUNT pages.\n"
+          "  -zswap=COUNT       Keep up to COUNT pages of compressed swap in RAM.\n"
+          "  -fa=COUNT          Map up to COUNT executable pages per page fault.\n"
 #endif
           );
   shutdown_power_off ();
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -23,13 +24,18 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   The idle thread zeroes free pages ahead of time, so that a
+   request for a single zeroed page can usually be served without
+   clearing it first. */
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    struct bitmap *zeroed_map;          /* Free pages known to be zeroed. */
     uint8_t *base;                      /* Base of pool. */
   };
 
@@ -39,6 +45,7 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static bool zero_free_page (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -72,13 +79,24 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
-  size_t page_idx;
+  size_t page_idx = BITMAP_ERROR;
+  bool zeroed = false;
 
   if (page_cnt == 0)
     return NULL;
 
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if ((flags & PAL_ZERO) && page_cnt == 1)
+    {
+      page_idx = bitmap_scan (pool->zeroed_map, 0, 1, true);
+      zeroed = page_idx != BITMAP_ERROR;
+      if (zeroed)
+        bitmap_mark (pool->used_map, page_idx);
+    }
+  if (page_idx == BITMAP_ERROR)
+    page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if (page_idx != BITMAP_ERROR)
+    bitmap_set_multiple (pool->zeroed_map, page_idx, page_cnt, false);
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
@@ -88,7 +106,7 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -148,15 +166,32 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Zeroes a free page that is not known to be zeroed yet, so that
+   a later request for a zeroed page doesn't have to.  For the idle
+   thread: it never blocks.  Returns true if a page was zeroed. */
+bool
+palloc_zero_free_page (void)
+{
+  return zero_free_page (&user_pool) || zero_free_page (&kernel_pool);
+}
+
+/* Returns the number of pages in the user pool. */
+size_t
+palloc_user_page_cnt (void) 
+{
+  return bitmap_size (user_pool.used_map);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map and zeroed_map at its base.
+     Calculate the space needed for the bitmaps
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (2 * bm_size, PGSIZE);
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -165,10 +200,43 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->zeroed_map = bitmap_create_in_buf (page_cnt, (uint8_t *) base + bm_size,
+                                        bm_size);
   p->base = base + bm_pages * PGSIZE;
 }
 
+/* Zeroes a free page of POOL that is not known to be zeroed.
+   Interrupts are turned off meanwhile, so that no other thread
+   can want POOL's lock while it is held; if the lock is already
+   held, gives up.  Returns true if a page was zeroed. */
+static bool
+zero_free_page (struct pool *pool)
+{
+  size_t page_cnt = bitmap_size (pool->used_map);
+  size_t page_idx = BITMAP_ERROR;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (lock_try_acquire (&pool->lock))
+    {
+      size_t i;
+
+      for (i = 0; i < page_cnt; i++)
+        if (!bitmap_test (pool->used_map, i)
+            && !bitmap_test (pool->zeroed_map, i))
+          {
+            page_idx = i;
+            memset (pool->base + PGSIZE * i, 0, PGSIZE);
+            bitmap_mark (pool->zeroed_map, i);
+            break;
+          }
+      lock_release (&pool->lock);
+    }
+  intr_set_level (old_level);
+  return page_idx != BITMAP_ERROR;
+}
+
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
@@ -15,6 +15,9 @@
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 /* Random value for struct thread's `magic' member.
    Used to detect stack overflow.  See the big comment at the top
@@ -453,6 +456,22 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* With nothing else to run, zero a free frame or page ahead
+         of the requests for zeroed memory that would otherwise
+         have to.  Then let any thread woken meanwhile run first. */
+#ifdef VM
+      if (frame_table_zero_free_frame ())
+        {
+          intr_enable ();
+          continue;
+        }
+#endif
+      if (palloc_zero_free_page ())
+        {
+          intr_enable ();
+          continue;
+        }
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -531,6 +550,14 @@ init_thread (struct thread *t, const char *name, int priority)
   memset (t->file_desc, NULL, sizeof (struct file*) * MAX_OPEN_FILES); 
   #endif
 
+  #ifdef VM
+  list_init (&t->vma_list);
+  list_init (&t->frame_list);
+  list_init (&t->frame_mappings);
+  list_init (&t->mmap_list);
+  t->next_mapid = 0;
+  #endif
+
   list_push_back (&all_list, &t->allelem);
 }
 
@@ -2,6 +2,7 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
 #include "devices/block.h"
@@ -27,6 +28,10 @@ typedef int pid_t;
 
 #define TID_ERROR ((tid_t) -1)          /* Error value for tid_t. */
 
+/* Memory-mapped file identifier type. */
+typedef int mapid_t;
+#define MAP_FAILED ((mapid_t) -1)       /* Error value for mapid_t. */
+
 /* Thread priorities. */
 #define PRI_MIN 0                       /* Lowest priority. */
 #define PRI_DEFAULT 31                  /* Default priority. */
@@ -133,6 +138,30 @@ struct thread
 
     block_sector_t cur_dir_sector;            /* Current directory */
 
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash supp_page_table;              /* Supplemental page table. */
+
+    /* Owned by userprog/syscall.c. */
+    void *user_esp;                           /* User stack pointer on entry to the kernel. */
+
+    /* Owned by vm/vma.c. */
+    struct list vma_list;                     /* Address space regions, by address. */
+
+    /* Owned by vm/frame.c. */
+    size_t rss;                               /* Pages resident in frames. */
+    size_t wss;                               /* Estimated working set, in pages. */
+    size_t ws_refs;                           /* Pages found accessed this interval. */
+    size_t frame_quota;                       /* Most frames to hold, or 0 for no limit. */
+    bool suspended;                           /* Kept from running by memory pressure. */
+    struct list frame_list;                   /* Frames mapped by this process first. */
+    struct list frame_mappings;               /* Other frame mappings, as struct frame_mapping. */
+
+    /* Owned by vm/mmap.c. */
+    struct list mmap_list;                    /* Memory-mapped files. */
+    mapid_t next_mapid;                       /* Next mapping identifier. */
+#endif
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
@@ -4,7 +4,12 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "userprog/syscall.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -152,9 +157,31 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* A not-present user page may just not be loaded yet, or may be
+     the next page of a growing stack.  A write to a present user page
+     may be the first store to a page that maps the shared zero frame.
+     A fault taken in the kernel while it accesses user memory on
+     behalf of a system call uses the user stack pointer saved on
+     entry to the system call. */
+  if ((not_present || write) && is_user_vaddr (fault_addr))
+    {
+      struct thread *t = thread_current ();
+      void *esp = user ? f->esp : t->user_esp;
+
+      /* A process suspended to relieve memory pressure waits here,
+         where it holds no locks, until there is room for it again. */
+      if (user)
+        frame_table_wait_if_suspended ();
+      if (supp_page_table_fault (&t->supp_page_table, fault_addr, esp, write))
+        return;
+    }
+#endif
+
   /* An attempt to acccess an unmapped user virtual address or a 
-     kernel virtual address will cause the program to exit. */
-  if (not_present || user)
+     kernel virtual address, or to write a read-only user page, will
+     cause the program to exit. */
+  if (not_present || user || is_user_vaddr (fault_addr))
     {
       exit (-1);
     }
@@ -7,7 +7,7 @@
 #include "threads/palloc.h"
 
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *vaddr);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -152,7 +152,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -177,10 +177,10 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
     {
       if (dirty)
         *pte |= PTE_D;
-      else 
+      else if ((*pte & PTE_D) != 0)
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -206,10 +206,10 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
     {
       if (accessed)
         *pte |= PTE_A;
-      else 
+      else if ((*pte & PTE_A) != 0)
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -248,16 +248,19 @@ active_pd (void)
    table.  When this happens, we have to "invalidate" the TLB by
    re-activating it.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates the TLB entry for VADDR if PD is the
+   active page directory.  (If PD is not active then its entries
+   are not in the TLB, so there is no need to invalidate
+   anything.)  Only that entry is flushed, so that clearing the
+   accessed bits of many pages doesn't throw away every other
+   cached translation. */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *vaddr) 
 {
   if (active_pd () == pd) 
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      /* See [IA32-v2a] "INVLPG--Invalidate TLB Entry" and
+         [IA32-v3a] 3.12 "Translation Lookaside Buffers (TLBs)". */
+      asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
     } 
 }
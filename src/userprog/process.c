@@ -14,14 +14,25 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+#include "vm/vma.h"
+#endif
 
 /* :D Max number of arguments. */
 #define ARG_MAX 128
 
 static thread_func start_process NO_RETURN;
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+static bool fork_process (struct thread *parent);
+#endif
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
 /* Newly added function declarations. */
@@ -108,6 +119,85 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+#ifdef VM
+/* Starts a new thread running a copy of the current user process,
+   which entered the kernel with interrupt frame F.  The copy shares
+   the process's pages until either process writes them, and gets
+   its own handles on the process's open files.  Returns the new
+   process's thread id, or TID_ERROR if the thread cannot be
+   created. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct intr_frame *if_copy;
+  tid_t tid;
+
+  if_copy = malloc (sizeof *if_copy);
+  if (if_copy == NULL)
+    return TID_ERROR;
+  *if_copy = *f;
+
+  tid = thread_create (thread_current ()->name, PRI_DEFAULT, start_fork, if_copy);
+  if (tid == TID_ERROR)
+    free (if_copy);
+  return tid;
+}
+
+/* A thread function that copies its parent's user process and
+   starts it running, returning 0 from the fork system call. */
+static void
+start_fork (void *if_copy)
+{
+  struct thread *parent = thread_current ()->parent_thread;
+  struct intr_frame if_ = *(struct intr_frame *) if_copy;
+  bool success;
+
+  free (if_copy);
+  success = fork_process (parent);
+  parent->load_success = success;
+  sema_up (&parent->load_sema);
+  if (!success)
+    thread_exit ();
+
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives the current thread a copy of PARENT's address space and open
+   files.  PARENT is blocked until this returns.  Returns true if
+   successful, false otherwise. */
+static bool
+fork_process (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  int fd;
+
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    return false;
+  supp_page_table_init (&t->supp_page_table);
+  process_activate ();
+
+  t->executable = file_reopen (parent->executable);
+  if (t->executable == NULL)
+    return false;
+  file_deny_write (t->executable);
+
+  for (fd = 2; fd < MAX_OPEN_FILES; fd++)
+    if (parent->file_desc[fd] != NULL)
+      {
+        t->file_desc[fd] = file_reopen (parent->file_desc[fd]);
+        if (t->file_desc[fd] == NULL)
+          return false;
+        file_seek (t->file_desc[fd], file_tell (parent->file_desc[fd]));
+      }
+
+  return (vma_copy (&t->vma_list, &parent->vma_list, t->executable)
+          && supp_page_table_fork (&t->supp_page_table, parent));
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -140,6 +230,17 @@ process_exit (void)
 {
   struct thread *cur = thread_current ();
   uint32_t *pd;
+
+#ifdef VM
+  /* Write back and unmap memory-mapped files. */
+  mmap_unmap_all ();
+
+  /* Release the process's frames and swap slots.  This must happen
+     while the executable its pages load from is still open. */
+  if (cur->pagedir != NULL)
+    supp_page_table_destroy (&cur->supp_page_table);
+  vma_destroy (&cur->vma_list);
+#endif
   
   /* Close the file loaded for the process. */
   if (cur->executable != NULL)
@@ -253,6 +354,7 @@ struct Elf32_Phdr
 #define PF_R 4          /* Readable. */
 
 static bool setup_stack (void **esp, char *file_name);
+static void push_arguments (void **esp, char *file_name);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
@@ -283,6 +385,9 @@ load (const char *file_name, void (**eip) (void), void **esp)
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
+#ifdef VM
+  supp_page_table_init (&t->supp_page_table);
+#endif
   process_activate ();
 
   /* Open executable file. */
@@ -393,7 +498,9 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -462,6 +569,14 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  /* Only record the segment's region; the page fault handler loads
+     each page the first time it is touched. */
+  return vma_add (&thread_current ()->vma_list, (uintptr_t) upage,
+                  (uintptr_t) upage + read_bytes + zero_bytes,
+                  writable ? VMA_DATA : VMA_CODE, writable, file, ofs,
+                  read_bytes) != NULL;
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -498,6 +613,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
     }
 
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -507,6 +623,49 @@ setup_stack (void **esp, char *file_name)
 {
   uint8_t *kpage;
   bool success = false;
+
+#ifdef VM
+  {
+    struct thread *t = thread_current ();
+    uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+    struct vma *stack;
+    int index;
+
+    /* The stack's region starts as one page, which is loaded right
+       away and pinned while the arguments are copied onto it. */
+    stack = vma_add (&t->vma_list, (uintptr_t) upage, (uintptr_t) PHYS_BASE,
+                     VMA_STACK, true, NULL, 0, 0);
+    if (stack == NULL
+        || supp_page_table_insert (&t->supp_page_table, stack,
+                                   (uintptr_t) upage, true) == NULL)
+      return false;
+    index = frame_table_assign_frame (t, upage, true, true);
+    kpage = pagedir_get_page (t->pagedir, upage);
+    memset (kpage, 0, PGSIZE);
+    push_arguments (esp, file_name);
+    frame_table_unpin_frame (index);
+    success = true;
+  }
+#else
+  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+  if (kpage != NULL) 
+    {
+      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
+      if (success)
+        push_arguments (esp, file_name);
+      else
+        palloc_free_page (kpage);
+    }
+#endif
+
+  return success;
+}
+
+/* Pushes the program name and arguments in FILE_NAME onto the
+   freshly mapped stack page and sets *ESP to the new top of stack. */
+static void
+push_arguments (void **esp, char *file_name)
+{
   /*An array of reversed argv for placement on stack*/
   char *reversed_argv[ARG_MAX];
   /*An array of argument's addresses for placement on stack*/
@@ -515,62 +674,51 @@ setup_stack (void **esp, char *file_name)
   int argc = 0;
   int i, j;
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-  if (kpage != NULL) 
+  *esp = PHYS_BASE;
+  /* Tokenize arguments and put them into the reversed argv array. */
+  for (token = strtok_r (file_name, " ", &save_ptr); token != NULL;
+        token = strtok_r (NULL, " ", &save_ptr))
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success)
-        {
-          *esp = PHYS_BASE;
-          /* Tokenize arguments and put them into the reversed argv array. */
-          for (token = strtok_r (file_name, " ", &save_ptr); token != NULL;
-                token = strtok_r (NULL, " ", &save_ptr))
-            {
-              reversed_argv[argc++] = token;
-            }
+      reversed_argv[argc++] = token;
+    }
 
-          /* Push the reverserved argv to stack. */
-          for (j = 0, i = argc - 1; i >= 0; --i, ++j)
-            {
-              *esp -= (1 + strlen (reversed_argv[i]));
-              memcpy (*esp, reversed_argv[i], 1 + strlen(reversed_argv[i]));
-              argv_addresses[j] = (uint32_t)*esp;
-            }
+  /* Push the reverserved argv to stack. */
+  for (j = 0, i = argc - 1; i >= 0; --i, ++j)
+    {
+      *esp -= (1 + strlen (reversed_argv[i]));
+      memcpy (*esp, reversed_argv[i], 1 + strlen(reversed_argv[i]));
+      argv_addresses[j] = (uint32_t)*esp;
+    }
 
-          /* Handle word alignment on stack */
-          *esp = ROUND_DOWN ((uint32_t) *esp, 4);
+  /* Handle word alignment on stack */
+  *esp = ROUND_DOWN ((uint32_t) *esp, 4);
 
-          /* Push null pointer sentinel to stack */
-          *esp -= sizeof (char *);
-          memcpy (*esp, NULL, 0);
+  /* Push null pointer sentinel to stack */
+  *esp -= sizeof (char *);
+  memcpy (*esp, NULL, 0);
 
-          /* Push argument addresses to stack */
-          for (i = 0; i < argc; ++i)
-            {
-              *esp -= sizeof (char *);
-              memcpy (*esp, &argv_addresses[i], sizeof (char *));
-            }
+  /* Push argument addresses to stack */
+  for (i = 0; i < argc; ++i)
+    {
+      *esp -= sizeof (char *);
+      memcpy (*esp, &argv_addresses[i], sizeof (char *));
+    }
 
-          /* Push argv */
-          *esp -= sizeof (char **);
-          char **argv_start_address = *esp + sizeof (char **);
-          memcpy (*esp, &argv_start_address, sizeof (char **));
+  /* Push argv */
+  *esp -= sizeof (char **);
+  char **argv_start_address = *esp + sizeof (char **);
+  memcpy (*esp, &argv_start_address, sizeof (char **));
 
-          /* Push argc */
-          *esp -= sizeof (int);
-          memcpy (*esp, &argc, sizeof (int));
+  /* Push argc */
+  *esp -= sizeof (int);
+  memcpy (*esp, &argc, sizeof (int));
 
-          /* Push dummy return address */
-          *esp -= sizeof (void (*) ());
-          memcpy (*esp, NULL, 0);
-        }
-      else
-        palloc_free_page (kpage);
-    }
-
-  return success;
+  /* Push dummy return address */
+  *esp -= sizeof (void (*) ());
+  memcpy (*esp, NULL, 0);
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -590,6 +738,7 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
 
 /* Return the file pointer at the specified index */
 struct file *
@@ -5,16 +5,26 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "devices/shutdown.h"
+#include "devices/timer.h"
 #include "lib/kernel/console.h"
 #include "threads/synch.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/directory.h"
+#include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "filesys/inode.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 #define READDIR_MAX_LEN 14
 
+/* Most bytes of a user buffer that read and write pin at once, so
+   that a large transfer can't pin every frame. */
+#define IO_CHUNK_SIZE (16 * PGSIZE)
+
  /* Dereference the pointer at ADDRESS + OFFSET. (4 byte address)
  as the type TYPE. */
 #define deref_address(ADDRESS, OFFSET, TYPE)                    \
@@ -25,6 +35,10 @@ static void syscall_handler (struct intr_frame *);
 /* Newly added function declarations. */
 static void check_user_program_addresses (void *address);
 static void check_file (char *file);
+static void check_user_page (const void *address);
+static void check_user_buffer (const void *buffer, unsigned size);
+static void pin_user_buffer (const void *buffer, unsigned size, bool write);
+static void unpin_user_buffer (const void *buffer, unsigned size);
 static void check_fd (int fd);
 static struct wait_node *search_child_wait_node_list_pid (struct list *child_wait_node_list, pid_t pid);
 static void check_stack_argument_addresses (void *start, int arg_count);
@@ -40,6 +54,12 @@ syscall_init (void)
 static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
+#ifdef VM
+  /* Page faults in the kernel need the user stack pointer to tell
+     stack growth from a bad access. */
+  thread_current ()->user_esp = f->esp;
+#endif
+
   /* Check the validity of the syscall number */
   check_user_program_addresses (f->esp);
 
@@ -141,6 +161,27 @@ syscall_handler (struct intr_frame *f UNUSED)
             f->eax = inumber (deref_address (f->esp, 1, int));
             break;
 
+#ifdef VM
+	  case SYS_MMAP:
+            check_stack_argument_addresses (f->esp, 2);
+            f->eax = mmap (deref_address (f->esp, 1, int), deref_address (f->esp, 2, void*));
+            break;
+
+	  case SYS_MUNMAP:
+            check_stack_argument_addresses (f->esp, 1);
+            munmap (deref_address (f->esp, 1, mapid_t));
+            break;
+
+	  case SYS_FORK:
+            f->eax = sys_fork (f);
+            break;
+#endif
+
+	  /* Benchmarks */
+	  case SYS_TICKS:
+            f->eax = timer_ticks ();
+            break;
+
 	  default:
       	    break;
   	}
@@ -180,6 +221,24 @@ exec (const char *file)
   return pid;
 }
 
+#ifdef VM
+/* fork system call.  Returns the child's pid to the parent, and 0 to
+   the child, which returns to user mode from start_fork(). */
+pid_t
+sys_fork (const struct intr_frame *f)
+{
+  pid_t pid = process_fork (f);
+
+  if (pid == TID_ERROR)
+    return -1;
+  /* Block the process while the child copies its address space. */
+  sema_down (&thread_current ()->load_sema);
+  if (!thread_current ()->load_success)
+    return -1;
+  return pid;
+}
+#endif
+
 /* wait system call. */
 int
 wait (pid_t pid)
@@ -255,72 +314,97 @@ filesize (int fd)
   return length;
 }
 
-/* read system call. */
+/* read system call.  BUFFER is filled a chunk at a time, with
+   the part of it being filled pinned, so that the file system
+   doesn't fault on it while holding its locks. */
 int
 read (int fd, void *buffer, unsigned size)
 {
+  uint8_t *p = buffer;
   int size_read = 0;
-  int i;
+  unsigned i;
 
-  check_file (buffer);
+  check_user_buffer (buffer, size);
 
-  /* Reads STDIN. */
-  if (fd == 0)
-    {
-      for (i = 0; i < size; i++)
-      {
-        char temp = input_getc();
-        *(((char *)buffer) + i) = temp;
-      }
-      size_read = size;
-    }
   /* Tries to read STDOUT, exit. */
-  else if (fd == 1)
+  if (fd == 1)
+    exit (-1);
+  if (fd != 0)
+    check_fd (fd);
+
+  while (size > 0)
     {
-      exit (-1);
-    }
-  /* Reads the file at FD. */
-  else
-    { 
-      check_fd (fd);
-      struct file *file = get_file_struct(fd);
-      size_read = file_read (get_file_struct (fd), buffer, size);
+      unsigned chunk = size < IO_CHUNK_SIZE ? size : IO_CHUNK_SIZE;
+      int chunk_read;
+
+      pin_user_buffer (p, chunk, true);
+      /* Reads STDIN. */
+      if (fd == 0)
+        {
+          for (i = 0; i < chunk; i++)
+            p[i] = input_getc ();
+          chunk_read = chunk;
+        }
+      /* Reads the file at FD. */
+      else
+        chunk_read = file_read (get_file_struct (fd), p, chunk);
+      unpin_user_buffer (p, chunk);
+
+      size_read += chunk_read;
+      if ((unsigned) chunk_read < chunk)
+        break;
+      p += chunk;
+      size -= chunk;
     }
   return size_read;
 }
 
-/* write system call. */
+/* write system call.  BUFFER is written a chunk at a time, with
+   the part of it being written pinned, so that the file system
+   doesn't fault on it while holding its locks. */
 int
 write (int fd, const void *buffer, unsigned size)
 {   
+  const uint8_t *p = buffer;
   int size_written = 0;
-  struct file *file;
+  struct file *file = NULL;
 
-  check_file (buffer);
+  check_user_buffer (buffer, size);
   /* Tries to write to STDIN, exits. */
   if (fd == 0)
     {
       exit(-1);
     }
-  /* Writes to STDOUT. */ 
-  else if (fd == 1)
-    {
-      putbuf (buffer, size);
-      size_written = size;  //Entire buffer written to console
-    }
-  /* Writes to the file at FD. */
-  else
+  /* Writes to the file at FD, unless it is a directory. */
+  else if (fd != 1)
     { 
       check_fd (fd);
       file = get_file_struct (fd);
       if (file->inode->data.is_dir)
+        return -1;
+    }
+
+  while (size > 0)
+    {
+      unsigned chunk = size < IO_CHUNK_SIZE ? size : IO_CHUNK_SIZE;
+      int chunk_written;
+
+      pin_user_buffer (p, chunk, false);
+      /* Writes to STDOUT. */ 
+      if (fd == 1)
         {
-          size_written = -1;
+          putbuf ((const char *) p, chunk);
+          chunk_written = chunk;  //Entire chunk written to console
         }
       else
-        {
-          size_written = file_write (file, buffer, size); 
-        }
+        chunk_written = file_write (file, p, chunk); 
+      unpin_user_buffer (p, chunk);
+
+      size_written += chunk_written;
+      if ((unsigned) chunk_written < chunk)
+        break;
+      p += chunk;
+      size -= chunk;
     }
   return size_written;
 }
@@ -445,14 +529,34 @@ inumber (int fd)
   return myfile->inode->sector;
 }
 
+#ifdef VM
+/* mmap system call. */
+mapid_t
+mmap (int fd, void *addr)
+{
+  /* The console can't be mapped. */
+  if (fd < 2 || fd >= MAX_OPEN_FILES || get_file_struct (fd) == NULL)
+    return MAP_FAILED;
+  return mmap_map (get_file_struct (fd), addr);
+}
+
+/* munmap system call. */
+void
+munmap (mapid_t mapping)
+{
+  mmap_unmap (mapping);
+}
+#endif
+
 /* END TODO */
 
 /* Checks the validity of a user process address. */ 
 static void
 check_user_program_addresses (void *address)
 {
-  if (address == NULL || !is_user_vaddr (address) || pagedir_get_page (thread_current ()->pagedir, address) == NULL)
-    exit (-1);  
+  if (address == NULL || !is_user_vaddr (address))
+    exit (-1);
+  check_user_page (address);
 }
 
 /* Given the stack pointer, check the validity of the given number of arguments (32-bit addresses) following it */
@@ -466,14 +570,101 @@ check_stack_argument_addresses (void *start, int arg_count)
     }
 }
 
-/* Checks the validity of the address of a file name. */
+/* Checks the validity of a file name: every byte of the string,
+   up to and including its null terminator, must be in a page of
+   the current process. */
 static void
 check_file (char *file)
 {
-  if (file == NULL || !is_user_vaddr (file) || pagedir_get_page (thread_current ()->pagedir, file) == NULL)
+  char *p;
+
+  if (file == NULL || !is_user_vaddr (file))
+    exit (-1);
+  check_user_page (file);
+  for (p = file; *p != '\0'; )
+    if (pg_ofs (++p) == 0)
+      {
+        if (!is_user_vaddr (p))
+          exit (-1);
+        check_user_page (p);
+      }
+}
+
+/* Exits unless the SIZE bytes at BUFFER are all at user
+   addresses. */
+static void
+check_user_buffer (const void *buffer, unsigned size)
+{
+  const uint8_t *end = (const uint8_t *) buffer + size;
+
+  if (buffer == NULL || !is_user_vaddr (buffer)
+      || end < (const uint8_t *) buffer
+      || (size > 0 && !is_user_vaddr (end - 1)))
     exit (-1);
 }
 
+/* Exits unless the SIZE bytes at BUFFER, checked by
+   check_user_buffer(), are all in pages of the current process.
+   With virtual memory, the pages must also be writable if WRITE is
+   true, and they are loaded and pinned, so that the kernel can
+   access them without faulting until unpin_user_buffer() is
+   called. */
+static void
+pin_user_buffer (const void *buffer, unsigned size, bool write UNUSED)
+{
+  const uint8_t *start = pg_round_down (buffer);
+  const uint8_t *end = (const uint8_t *) buffer + size;
+  const uint8_t *page;
+
+  for (page = start; page < end; page += PGSIZE)
+    {
+      const void *addr = page == start ? buffer : page;
+#ifdef VM
+      struct thread *t = thread_current ();
+
+      if (!supp_page_table_pin (&t->supp_page_table, addr, t->user_esp, write))
+        {
+          unpin_user_buffer (start, page - start);
+          exit (-1);
+        }
+#else
+      check_user_page (addr);
+#endif
+    }
+}
+
+/* Unpins the SIZE bytes at BUFFER, pinned by pin_user_buffer(). */
+static void
+unpin_user_buffer (const void *buffer, unsigned size)
+{
+  const uint8_t *end = (const uint8_t *) buffer + size;
+  const uint8_t *page;
+
+  for (page = pg_round_down (buffer); page < end; page += PGSIZE)
+    {
+#ifdef VM
+      struct thread *t = thread_current ();
+      supp_page_table_unpin (&t->supp_page_table, page);
+#endif
+    }
+}
+
+/* Exits unless ADDRESS is in a page of the current process, faulting
+   the page in first if it has not been loaded yet. */
+static void
+check_user_page (const void *address)
+{
+  struct thread *t = thread_current ();
+
+  if (pagedir_get_page (t->pagedir, address) != NULL)
+    return;
+#ifdef VM
+  if (supp_page_table_fault (&t->supp_page_table, address, t->user_esp, false))
+    return;
+#endif
+  exit (-1);
+}
+
 /* Checks the validity of a file descriptor. */
 static void
 check_fd (int fd)
@@ -22,6 +22,14 @@ void seek (int fd, unsigned position);
 unsigned tell (int fd);
 void close (int fd);
 
+/* System call declarations for project 3. */
+#ifdef VM
+struct intr_frame;
+mapid_t mmap (int fd, void *addr);
+void munmap (mapid_t);
+pid_t sys_fork (const struct intr_frame *);
+#endif
+
 /* System call declarations for project 4 */ 
 bool chdir (const char *dir);
 bool mkdir (const char *dir);
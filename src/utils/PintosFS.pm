@@ -0,0 +1,440 @@
+# Pintos file system image helpers.
+#
+# These subroutines understand the on-disk format implemented by
+# filesys/inode.c, filesys/directory.c, and filesys/free-map.c, so
+# that file system partitions can be built and inspected on the host
+# instead of through the in-guest "extract" action.  Keep them in
+# sync with those files.
+
+use POSIX;
+
+# Sector size, see devices/block.h.
+our $SECTOR_SIZE = 512;
+
+# Sectors of system file inodes, see filesys/filesys.h.
+our $FREE_MAP_SECTOR = 0;
+our $ROOT_DIR_SECTOR = 1;
+
+# Multi-level index geometry, see filesys/inode.h.
+our $NUM_DIRECT_BLOCKS = 124;
+our $INDIRECT_BLOCK_SECTORS = $SECTOR_SIZE / 4;
+our $MAX_INDEX_DIRECT = $NUM_DIRECT_BLOCKS;
+our $MAX_INDEX_INDIRECT = $MAX_INDEX_DIRECT + $INDIRECT_BLOCK_SECTORS;
+our $MAX_INDEX_DOUBLE_INDIRECT
+  = $MAX_INDEX_INDIRECT + $INDIRECT_BLOCK_SECTORS * $INDIRECT_BLOCK_SECTORS;
+
+# Directory format, see filesys/directory.h.  A directory entry is a
+# 4-byte inode sector, a NAME_MAX + 1 byte name, and an in_use byte.
+our $NAME_MAX = 14;
+our $DIR_ENTRY_SIZE = 4 + $NAME_MAX + 1 + 1;
+
+# Number of entries a new directory has room for, matching the
+# dir_create() calls in filesys/filesys.c.
+our $DIR_INITIAL_ENTRIES = 16;
+
+# File system trees.
+#
+# A tree is built out of nodes, each of which is a reference to a
+# hash.  Every node has TYPE => 'file' or 'dir'.  File nodes carry
+# DATA => the file's contents.  Directory nodes carry ENTRIES =>
+# reference to an array of [NAME, NODE] pairs, not including "." and
+# "..", which are added when the directory is written.  The layout
+# code additionally fills in INODE => inode sector, INDEX => reference
+# to the array of index block sectors, and SECTORS => reference to the
+# array of data sectors, in file order.
+
+# fs_new_dir()
+#
+# Returns a new, empty directory node.
+sub fs_new_dir {
+    return {TYPE => 'dir', ENTRIES => []};
+}
+
+# fs_new_file($data)
+#
+# Returns a new file node with contents $data.
+sub fs_new_file {
+    my ($data) = @_;
+    return {TYPE => 'file', DATA => $data};
+}
+
+# fs_lookup($dir, $name)
+#
+# Returns the node named $name in directory node $dir, or undef if
+# there is none.
+sub fs_lookup {
+    my ($dir, $name) = @_;
+    foreach my $e (@{$dir->{ENTRIES}}) {
+	return $e->[1] if $e->[0] eq $name;
+    }
+    return undef;
+}
+
+# fs_add($root, $path, $node)
+#
+# Adds $node to the tree rooted at $root under the slash-separated
+# $path, creating intermediate directories as needed.  Dies if $path
+# is invalid or already exists.
+sub fs_add {
+    my ($root, $path, $node) = @_;
+    my (@names) = grep ($_ ne '', split ('/', $path));
+    die "$path: invalid file name\n" if !@names;
+
+    my ($last) = pop (@names);
+    my ($dir) = $root;
+    foreach my $name (@names, $last) {
+	die "$path: \"$name\" is not a valid Pintos file name\n"
+	  if length ($name) > $NAME_MAX || $name eq '.' || $name eq '..';
+    }
+    foreach my $name (@names) {
+	my ($child) = fs_lookup ($dir, $name);
+	if (!defined $child) {
+	    $child = fs_new_dir ();
+	    push (@{$dir->{ENTRIES}}, [$name, $child]);
+	}
+	die "$path: \"$name\" is not a directory\n" if $child->{TYPE} ne 'dir';
+	$dir = $child;
+    }
+    die "$path: already exists\n" if defined fs_lookup ($dir, $last);
+    push (@{$dir->{ENTRIES}}, [$last, $node]);
+}
+
+# fs_nodes($root)
+#
+# Returns all the nodes in the tree rooted at $root in breadth-first
+# order, so that directories are laid out before the files in them
+# and siblings end up next to each other.
+sub fs_nodes {
+    my ($root) = @_;
+    my (@nodes) = ($root);
+    for (my ($i) = 0; $i < @nodes; $i++) {
+	next if $nodes[$i]{TYPE} ne 'dir';
+	push (@nodes, map ($_->[1], @{$nodes[$i]{ENTRIES}}));
+    }
+    return @nodes;
+}
+
+# fs_dir_length($node)
+#
+# Returns the length in bytes of directory $node once written,
+# counting "." and "..".
+sub fs_dir_length {
+    my ($node) = @_;
+    my ($entries) = 2 + @{$node->{ENTRIES}};
+    $entries = $DIR_INITIAL_ENTRIES if $entries < $DIR_INITIAL_ENTRIES;
+    return $entries * $DIR_ENTRY_SIZE;
+}
+
+# fs_length($node)
+#
+# Returns the length in bytes of file or directory $node.
+sub fs_length {
+    my ($node) = @_;
+    return $node->{TYPE} eq 'dir' ? fs_dir_length ($node)
+				  : length ($node->{DATA});
+}
+
+# fs_index_sectors($data_sectors)
+#
+# Returns the number of index blocks (indirect, double indirect, and
+# second-level blocks) needed by a file with $data_sectors sectors of
+# data.  Dies if the file is too big for the inode format.
+sub fs_index_sectors {
+    my ($data_sectors) = @_;
+    die "file too large for Pintos inode ($data_sectors sectors)\n"
+      if $data_sectors > $MAX_INDEX_DOUBLE_INDIRECT;
+
+    my ($cnt) = 0;
+    $cnt++ if $data_sectors > $MAX_INDEX_DIRECT;
+    $cnt += 1 + div_round_up ($data_sectors - $MAX_INDEX_INDIRECT,
+			      $INDIRECT_BLOCK_SECTORS)
+      if $data_sectors > $MAX_INDEX_INDIRECT;
+    return $cnt;
+}
+
+# fs_free_map_length($sector_cnt)
+#
+# Returns the length in bytes of the free map file of a file system
+# with $sector_cnt sectors.  The kernel writes its bitmap as an array
+# of 32-bit elements (see bitmap_file_size() in lib/kernel/bitmap.c).
+sub fs_free_map_length {
+    my ($sector_cnt) = @_;
+    return div_round_up ($sector_cnt, 32) * 4;
+}
+
+# fs_sectors_needed($root)
+#
+# Returns the minimum number of sectors in a file system containing
+# the tree rooted at $root.  The free map itself is left out, since
+# its size depends on the size of the file system.
+sub fs_sectors_needed {
+    my ($root) = @_;
+    my ($total) = 1;				# Free map inode.
+    foreach my $node (fs_nodes ($root)) {
+	my ($data_sectors) = div_round_up (fs_length ($node), $SECTOR_SIZE);
+	$total += 1 + $data_sectors + fs_index_sectors ($data_sectors);
+    }
+    return $total;
+}
+
+# fs_make_image($root, $sector_cnt)
+#
+# Lays out the tree rooted at $root in a new file system of
+# $sector_cnt sectors and returns the contents of the partition.
+#
+# The layout puts all the metadata at the start of the partition:
+# the free map and root directory inodes in their fixed sectors, the
+# free map data, every other inode, and then directory contents, all
+# in breadth-first order.  The data for each regular file follows,
+# with each file's index blocks immediately before its data so that
+# every file occupies exactly one contiguous run of sectors.
+sub fs_make_image {
+    my ($root, $sector_cnt) = @_;
+
+    my ($free_map) = {TYPE => 'file', INODE => $FREE_MAP_SECTOR,
+		      DATA => "\0" x fs_free_map_length ($sector_cnt)};
+    my (@nodes) = fs_nodes ($root);
+    my (@dirs) = grep ($_->{TYPE} eq 'dir', @nodes);
+    my (@files) = grep ($_->{TYPE} eq 'file', @nodes);
+
+    # Assign inode and data sectors.
+    my ($next) = $ROOT_DIR_SECTOR + 1;
+    $root->{INODE} = $ROOT_DIR_SECTOR;
+    $next = fs_place_data ($free_map, $next);
+    $_->{INODE} = $next++ foreach @nodes[1...$#nodes];
+    $next = fs_place_data ($_, $next) foreach @dirs, @files;
+    die sprintf ("file system needs %d sectors (%.2f MB) but has only %d\n",
+		 $next, $next * $SECTOR_SIZE / 1024 / 1024, $sector_cnt)
+      if $next > $sector_cnt;
+
+    # Directory contents can only be generated once every inode has
+    # a sector.
+    my (%parent);
+    foreach my $dir (@dirs) {
+	$parent{$_->[1]} = $dir foreach @{$dir->{ENTRIES}};
+    }
+    foreach my $dir (@dirs) {
+	my ($up) = $parent{$dir} || $dir;
+	$dir->{DATA} = fs_pack_dir ([['.', $dir], ['..', $up],
+				     @{$dir->{ENTRIES}}]);
+    }
+
+    # Mark every sector in use in the free map.
+    my ($bits) = '';
+    vec ($bits, $_, 1) = 1 foreach 0...$next - 1;
+    substr ($free_map->{DATA}, 0, length ($bits)) = $bits;
+
+    # Write everything out.
+    my ($image) = "\0" x ($sector_cnt * $SECTOR_SIZE);
+    foreach my $node ($free_map, @nodes) {
+	fs_write_node (\$image, $node, $node->{TYPE} eq 'dir');
+    }
+    return $image;
+}
+
+# fs_place_data($node, $next)
+#
+# Assigns sectors starting at $next to the index blocks and data of
+# $node and returns the first sector after them.
+sub fs_place_data {
+    my ($node, $next) = @_;
+    my ($data_sectors) = div_round_up (fs_length ($node), $SECTOR_SIZE);
+    my ($index_sectors) = fs_index_sectors ($data_sectors);
+
+    $node->{INDEX} = [$next...$next + $index_sectors - 1];
+    $next += $index_sectors;
+    $node->{SECTORS} = [$next...$next + $data_sectors - 1];
+    return $next + $data_sectors;
+}
+
+# fs_pack_dir(\@entries)
+#
+# Returns the on-disk contents of a directory holding @entries, each
+# a [NAME, NODE] pair whose NODE already has an INODE assigned.
+sub fs_pack_dir {
+    my ($entries) = @_;
+    my ($data) = '';
+    foreach my $e (@$entries) {
+	$data .= pack ("V a" . ($NAME_MAX + 1) . " C",
+		       $e->[1]{INODE}, $e->[0], 1);
+    }
+    my ($entry_cnt) = scalar (@$entries);
+    $entry_cnt = $DIR_INITIAL_ENTRIES if $entry_cnt < $DIR_INITIAL_ENTRIES;
+    return pack ("a" . $entry_cnt * $DIR_ENTRY_SIZE, $data);
+}
+
+# fs_write_node(\$image, $node, $is_dir)
+#
+# Writes the inode, index blocks, and data of $node into $image
+# according to its INODE, INDEX, and SECTORS.
+sub fs_write_node {
+    my ($image, $node, $is_dir) = @_;
+    my (@sectors) = @{$node->{SECTORS}};
+    my (@index) = @{$node->{INDEX}};
+
+    # Data.
+    for my $i (0...$#sectors) {
+	fs_put_sector ($image, $sectors[$i],
+		       substr ($node->{DATA}, $i * $SECTOR_SIZE, $SECTOR_SIZE));
+    }
+
+    # Index blocks.
+    my (@direct) = splice (@sectors, 0, $NUM_DIRECT_BLOCKS);
+    my ($indirect, $double_indirect) = (0, 0);
+    if (@sectors) {
+	$indirect = shift (@index);
+	fs_put_sector ($image, $indirect,
+		       pack ("V*", splice (@sectors, 0,
+					   $INDIRECT_BLOCK_SECTORS)));
+    }
+    if (@sectors) {
+	$double_indirect = shift (@index);
+	fs_put_sector ($image, $double_indirect, pack ("V*", @index));
+	foreach my $second_level (@index) {
+	    fs_put_sector ($image, $second_level,
+			   pack ("V*", splice (@sectors, 0,
+					       $INDIRECT_BLOCK_SECTORS)));
+	}
+    }
+
+    # Inode.  See struct inode_disk in filesys/inode.h.
+    fs_put_sector ($image, $node->{INODE},
+		   pack ("V$NUM_DIRECT_BLOCKS V V V C",
+			 @direct, (0) x ($NUM_DIRECT_BLOCKS - @direct),
+			 $indirect, $double_indirect,
+			 length ($node->{DATA}), $is_dir ? 1 : 0));
+}
+
+# fs_put_sector(\$image, $sector, $data)
+#
+# Stores $data, padded with zeros to a full sector, as sector $sector
+# of $image.
+sub fs_put_sector {
+    my ($image, $sector, $data) = @_;
+    substr ($$image, $sector * $SECTOR_SIZE, $SECTOR_SIZE)
+      = pack ("a$SECTOR_SIZE", $data);
+}
+
+
+# fs_get_sector(\$image, $sector)
+#
+# Returns sector $sector of $image.  Dies if $sector is outside the
+# image.
+sub fs_get_sector {
+    my ($image, $sector) = @_;
+    die "sector $sector is outside the file system\n"
+      if ($sector + 1) * $SECTOR_SIZE > length ($$image);
+    return substr ($$image, $sector * $SECTOR_SIZE, $SECTOR_SIZE);
+}
+
+# fs_read_node(\$image, $sector)
+#
+# Reads the inode in $sector of $image and returns a node for it, as
+# described above, with INODE, INDEX, SECTORS, and DATA filled in
+# from the image.  Directory nodes come back without ENTRIES; use
+# fs_read_tree() to read whole directory trees.
+sub fs_read_node {
+    my ($image, $sector) = @_;
+    my (@direct) = unpack ("V$NUM_DIRECT_BLOCKS V V V C",
+			   fs_get_sector ($image, $sector));
+    my ($is_dir) = pop (@direct);
+    my ($length) = pop (@direct);
+    my ($double_indirect) = pop (@direct);
+    my ($indirect) = pop (@direct);
+    die "inode $sector: bad length $length\n"
+      if $length > length ($$image) || $length >= 2**31;
+
+    my ($cnt) = div_round_up ($length, $SECTOR_SIZE);
+    die "inode $sector: file too large for inode format\n"
+      if $cnt > $MAX_INDEX_DOUBLE_INDIRECT;
+    my (@sectors) = @direct[0...min ($cnt, $MAX_INDEX_DIRECT) - 1];
+    my (@index);
+    if ($cnt > $MAX_INDEX_DIRECT) {
+	push (@index, $indirect);
+	my (@block) = unpack ("V*", fs_get_sector ($image, $indirect));
+	push (@sectors, @block[0...min ($cnt - $MAX_INDEX_DIRECT,
+					$INDIRECT_BLOCK_SECTORS) - 1]);
+    }
+    if ($cnt > $MAX_INDEX_INDIRECT) {
+	push (@index, $double_indirect);
+	my (@first_level) = unpack ("V*",
+				    fs_get_sector ($image, $double_indirect));
+	for (my ($left) = $cnt - $MAX_INDEX_INDIRECT; $left > 0;
+	     $left -= $INDIRECT_BLOCK_SECTORS) {
+	    my ($second_level) = shift (@first_level);
+	    push (@index, $second_level);
+	    my (@block) = unpack ("V*", fs_get_sector ($image, $second_level));
+	    push (@sectors,
+		  @block[0...min ($left, $INDIRECT_BLOCK_SECTORS) - 1]);
+	}
+    }
+
+    my ($data) = join ('', map (fs_get_sector ($image, $_), @sectors));
+    return {TYPE => $is_dir ? 'dir' : 'file', INODE => $sector,
+	    INDEX => \@index, SECTORS => \@sectors,
+	    DATA => substr ($data, 0, $length)};
+}
+
+# fs_read_tree(\$image)
+#
+# Reads the file system in $image and returns two nodes: the free map
+# file and the root directory, which heads a tree of nodes as described
+# above.  Removed directory entries, ".", and ".." are dropped.  Dies
+# if the directory structure is damaged.
+sub fs_read_tree {
+    my ($image) = @_;
+    my ($free_map) = fs_read_node ($image, $FREE_MAP_SECTOR);
+    my ($root) = fs_read_node ($image, $ROOT_DIR_SECTOR);
+    die "root directory inode is not a directory\n" if $root->{TYPE} ne 'dir';
+
+    my (%seen) = ($FREE_MAP_SECTOR => 1, $ROOT_DIR_SECTOR => 1);
+    my (@dirs) = ($root);
+    while (my $dir = shift (@dirs)) {
+	$dir->{ENTRIES} = [];
+	for (my ($ofs) = 0; $ofs + $DIR_ENTRY_SIZE <= length ($dir->{DATA});
+	     $ofs += $DIR_ENTRY_SIZE) {
+	    my ($sector, $name, $in_use)
+	      = unpack ("V Z" . ($NAME_MAX + 1) . " C",
+			substr ($dir->{DATA}, $ofs, $DIR_ENTRY_SIZE));
+	    next if !$in_use || $name eq '.' || $name eq '..';
+	    die "inode $dir->{INODE}: \"$name\" refers to inode $sector, "
+	      . "which is already in use\n" if $seen{$sector}++;
+
+	    my ($node) = fs_read_node ($image, $sector);
+	    push (@{$dir->{ENTRIES}}, [$name, $node]);
+	    push (@dirs, $node) if $node->{TYPE} eq 'dir';
+	}
+    }
+    return ($free_map, $root);
+}
+
+# fs_runs(@sectors)
+#
+# Splits @sectors into runs of consecutive sectors and returns the
+# length of each run, in order.
+sub fs_runs {
+    my (@runs);
+    my ($prev);
+    foreach my $sector (@_) {
+	if (defined ($prev) && $sector == $prev + 1) {
+	    $runs[$#runs]++;
+	} else {
+	    push (@runs, 1);
+	}
+	$prev = $sector;
+    }
+    return @runs;
+}
+
+# min(@args)
+#
+# Returns the numerically smallest value in @args.
+sub min {
+    my ($min) = $_[0];
+    foreach (@_[1..$#_]) {
+	$min = $_ if $_ < $min;
+    }
+    return $min;
+}
+
+1;
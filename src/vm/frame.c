@@ -1,64 +1,201 @@
 #include <debug.h>
+#include <string.h>
 #include "page.h"
 #include "frame.h"
 #include "swap.h"
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/vaddr.h"
-
-#define MAX_USR_FRAME_NUM 383 /* Maximum number of frames in pintos. */
+#include "userprog/pagedir.h"
 
 static bool install_page (struct thread *t, void *upage, void *kpage, bool writable);
-static int do_eviction (struct thread *t, uint8_t *new_upage, bool writable);
-static int get_victim ();
+static struct frame_table_entry *take_frame (struct thread *t);
+static struct frame_table_entry *get_free_frame (void);
+static void release_frame (struct frame_table_entry *frame);
+static size_t free_frame_cnt (void);
+static bool evict_frame (struct thread *only);
+static bool frame_is_dirty (struct frame_table_entry *frame, struct supp_page *entry);
+static bool page_is_zero (const uint8_t *kpage);
+static bool clean_frame (struct frame_table_entry *frame, struct supp_page *entry);
+static void clean_queued_frames (void);
+static int get_victim (struct thread *only);
+static void write_back (struct frame_table_entry *frame, struct supp_page *entry);
+static void pageout_thread (void *aux);
+static struct frame_table_entry *find_frame (struct thread *t, uint8_t *upage);
+static bool drop_mapping (struct frame_table_entry *frame, struct thread *t, uint8_t *upage);
+static bool frame_is_accessed (struct frame_table_entry *frame);
+static void unmap_sharers (struct frame_table_entry *frame, struct supp_page *entry);
+static void free_sharers (struct frame_table_entry *frame);
+static void zero_free_frames (void);
+static void update_working_sets (void);
+static void sample_working_sets (void);
+static hash_hash_func shared_frame_hash;
+static hash_less_func shared_frame_less;
+
+/* The frame table, with one entry for each page in the user pool.
+	An entry's frame is obtained from the user pool the first time the
+	entry is used. */
+static struct frame_table_entry *frame_table;
+
+/* Number of entries in the frame table. */
+static size_t frame_cnt;
 
-/* The frame table, which contains 383 (number of physical/kernel pages in pintos) entries. */
-struct frame_table_entry frame_table[MAX_USR_FRAME_NUM];
+/* Entries whose frame has been obtained from the user pool but
+	is not in use, and how many there are.  Frames on free_frames are
+	zeroed.  Released frames go on unzeroed_frames instead, for the
+	pageout thread to zero in the background; unzeroed_cnt includes the
+	frames it is zeroing. */
+static struct list free_frames;
+static size_t free_list_cnt;
+static struct list unzeroed_frames;
+static size_t unzeroed_cnt;
 
-/* Lock for accessing the frame table. */
+/* Index of the first entry that has not obtained its frame yet.
+	All the entries from here to the end of the table are unused. */
+static size_t unused_idx;
+
+/* Lock for accessing the frame table.  It is never held across
+	disk I/O. */
 static struct lock frame_table_lock;
 
+/* Free-frame watermarks.  The pageout thread is woken when fewer
+	than free_low frames are free and evicts pages until free_high
+	frames are. */
+static size_t free_low;
+static size_t free_high;
+
+/* Signaled when the free frames drop below the low watermark. */
+static struct condition pageout_cond;
+
+/* Broadcast when a frame is done being cleaned. */
+static struct condition cleaned_cond;
+
+/* Dirty frames passed over by get_victim(), for the pageout thread
+	to write out so that they can be evicted later without waiting. */
+static struct list clean_queue;
+
+/* Frames that hold a read-only page of an executable, by inode and
+	offset, so that every process running the executable maps the same
+	frame.  Each such frame is mapped by its T and by its sharers; all
+	of them are unmapped when it is evicted.  A frame shared
+	copy-on-write after a fork has sharers too, but no inode. */
+static struct hash shared_frames;
+
+/* A kernel page of zeros, mapped read-only at every user page of
+	zeros that has only been read. */
+static uint8_t *zero_frame;
+
+/* Processes suspended to relieve memory pressure, and the condition
+	they wait on to resume. */
+static size_t suspended_cnt;
+static struct condition resume_cond;
+
+/* How often the pageout thread samples accessed bits while a process
+	is suspended. */
+#define WS_SAMPLE_TICKS (TIMER_FREQ / 4)
+
+/* Fewest frames a process's quota may allow. */
+#define QUOTA_MIN_FRAMES 16
+
 /* Index of the victim during eviction. */
 int next_victim = 0;
 
 /* Initialization of the frame table.  */
-void 
+void
 frame_table_init ()
 {
 	lock_init (&frame_table_lock);
+	cond_init (&pageout_cond);
+	cond_init (&cleaned_cond);
+	cond_init (&resume_cond);
+	list_init (&free_frames);
+	list_init (&unzeroed_frames);
+	list_init (&clean_queue);
+
+	/* The idle thread zeroes frames once the frame table is set. */
+	frame_cnt = palloc_user_page_cnt ();
+	frame_table = malloc (frame_cnt * sizeof *frame_table);
+	if (frame_table == NULL)
+		PANIC ("Not enough memory for the frame table.");
+	if (!hash_init (&shared_frames, shared_frame_hash, shared_frame_less, NULL))
+		PANIC ("Not enough memory for the shared frames table.");
+	free_list_cnt = 0;
+	unzeroed_cnt = 0;
+	unused_idx = 0;
 
-	int i;
-	for (i = 0; i < MAX_USR_FRAME_NUM; ++i)
+	size_t i;
+	for (i = 0; i < frame_cnt; ++i)
 		{
 			frame_table[i].t = NULL;
 			frame_table[i].upage = NULL;
-			frame_table[i].kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-			frame_table[i].pin = false;
+			frame_table[i].entry = NULL;
+			frame_table[i].kpage = NULL;
+			frame_table[i].pin_cnt = 0;
+			frame_table[i].cleaning = false;
+			frame_table[i].clean_queued = false;
+			frame_table[i].inode = NULL;
+			list_init (&frame_table[i].sharers);
 		}
+
+	zero_frame = palloc_get_page (PAL_ZERO | PAL_ASSERT);
+
+	free_low = frame_cnt / 64 + 1;
+	free_high = frame_cnt / 32 + 2;
+	if (thread_create ("pageout", PRI_DEFAULT, pageout_thread, NULL) == TID_ERROR)
+		PANIC ("Couldn't start the pageout thread.");
 }
 
-/* Assigns a physical frame to a user page, if there are no more empty frame, do eviction and replacement. */
+/* Assigns a physical frame to a user page.  A free frame is normally
+	ready, kept so by the pageout thread; if there is none, evict a page
+	right away.  A process that holds as many frames as its quota allows
+	gives up one of its own pages first.  The frame is zeroed.  T must
+	be the current process, and must have an entry for UPAGE in its
+	supplemental page table. */
 int
 frame_table_assign_frame (struct thread *t, uint8_t *upage, bool writable, bool pin)
 {
 	ASSERT (upage != NULL);
-	int i;
+	ASSERT (t == thread_current ());
+	struct frame_table_entry *frame;
+	struct supp_page *entry;
+
+	entry = supp_page_table_find_entry (&t->supp_page_table, (uintptr_t) upage);
+	ASSERT (entry != NULL);
 
 	lock_acquire (&frame_table_lock);
-	for (i = 0; i < MAX_USR_FRAME_NUM; ++i)
-		{
-		if (frame_table[i].t == NULL)
-			{
-				frame_table[i].t = t;
-				frame_table[i].upage = upage;
-				ASSERT (install_page (t, upage, frame_table[i].kpage, writable));
-				frame_table[i].pin = pin;
-				lock_release(&frame_table_lock);
-				return i;
-			}
-		}
-	/* If the program reaches here, this means the frame table is full, performs eviction. */
-	int index = do_eviction (t, upage, writable);
+	frame = take_frame (t);
+	frame->t = t;
+	frame->upage = upage;
+	frame->entry = entry;
+	ASSERT (install_page (t, upage, frame->kpage, writable));
+	frame->pin_cnt = pin ? 1 : 0;
+	list_push_back (&t->frame_list, &frame->owner_elem);
+	t->rss++;
 	lock_release(&frame_table_lock);
-	return index;
+	return frame - frame_table;
+}
+
+/* Returns the shared frame of zeros. */
+uint8_t *
+frame_table_zero_frame (void)
+{
+	return zero_frame;
+}
+
+/* Returns how many more frames are free than the pageout thread
+	keeps in reserve, which can be used for pages that are not needed
+	yet without evicting anything. */
+size_t
+frame_table_spare_frames (void)
+{
+	size_t free_cnt;
+
+	lock_acquire (&frame_table_lock);
+	free_cnt = free_frame_cnt ();
+	lock_release (&frame_table_lock);
+	return free_cnt > free_low ? free_cnt - free_low : 0;
 }
 
 /* Unpins a frame in the frame table. */
@@ -66,29 +203,302 @@ void
 frame_table_unpin_frame (int index)
 {
 	lock_acquire (&frame_table_lock);
-	frame_table[index].pin = false;
+	frame_table[index].pin_cnt--;
+	lock_release (&frame_table_lock);
+}
+
+/* Pins the frame mapped at UPAGE of thread T, so that it is not
+	evicted until frame_table_unpin_page() is called.  Returns false if
+	no frame is mapped there, as when the page was just evicted. */
+bool
+frame_table_pin_page (struct thread *t, uint8_t *upage)
+{
+	struct frame_table_entry *frame;
+
+	lock_acquire (&frame_table_lock);
+
+	/* Let a write by the pageout thread finish; it may evict the page. */
+	while ((frame = find_frame (t, upage)) != NULL && frame->cleaning)
+		cond_wait (&cleaned_cond, &frame_table_lock);
+	if (frame != NULL)
+		frame->pin_cnt++;
+	lock_release (&frame_table_lock);
+	return frame != NULL;
+}
+
+/* Unpins the frame mapped at UPAGE of thread T, pinned by
+	frame_table_pin_page(). */
+void
+frame_table_unpin_page (struct thread *t, uint8_t *upage)
+{
+	struct frame_table_entry *frame;
+
+	lock_acquire (&frame_table_lock);
+	frame = find_frame (t, upage);
+	ASSERT (frame != NULL && frame->pin_cnt > 0);
+	frame->pin_cnt--;
+	lock_release (&frame_table_lock);
+}
+
+/* Maps the shared frame that holds the page at OFFSET in executable
+	INODE, if there is one, read-only at UPAGE of thread T.  Returns
+	true if successful, false if no frame holds that page yet. */
+bool
+frame_table_map_shared (struct thread *t, uint8_t *upage, struct inode *inode, off_t offset)
+{
+	struct frame_table_entry key, *frame = NULL;
+	struct frame_mapping *m;
+	struct hash_elem *e;
+
+	m = malloc (sizeof *m);
+	if (m == NULL)
+		return false;
+	m->entry = supp_page_table_find_entry (&t->supp_page_table, (uintptr_t) upage);
+	ASSERT (m->entry != NULL);
+
+	lock_acquire (&frame_table_lock);
+	key.inode = inode;
+	key.offset = offset;
+	e = hash_find (&shared_frames, &key.share_elem);
+	if (e != NULL)
+		{
+			frame = hash_entry (e, struct frame_table_entry, share_elem);
+			if (install_page (t, upage, frame->kpage, false))
+				{
+					m->t = t;
+					m->upage = upage;
+					m->frame = frame;
+					list_push_back (&frame->sharers, &m->elem);
+					list_push_back (&t->frame_mappings, &m->thread_elem);
+					t->rss++;
+				}
+			else
+				frame = NULL;
+		}
+	lock_release (&frame_table_lock);
+
+	if (frame == NULL)
+		free (m);
+	return frame != NULL;
+}
+
+/* Offers the frame at INDEX, just loaded with the read-only page at
+	OFFSET in executable INODE, to other processes that load the same
+	page.  Does nothing if another frame already holds the page. */
+void
+frame_table_share_frame (int index, struct inode *inode, off_t offset)
+{
+	struct frame_table_entry *frame = &frame_table[index];
+
+	lock_acquire (&frame_table_lock);
+	frame->inode = inode;
+	frame->offset = offset;
+	if (hash_insert (&shared_frames, &frame->share_elem) != NULL)
+		frame->inode = NULL;
+	lock_release (&frame_table_lock);
+}
+
+/* Gives CHILD, a process being forked from PARENT, a copy of
+	PARENT's page described by PARENT_ENTRY, described by CHILD_ENTRY,
+	which becomes a copy of PARENT_ENTRY.  A page in a frame is mapped
+	by both processes, read-only; if it is writable, both get a private
+	copy when they first write it.  A page in swap is shared through
+	its slot.  PARENT must not be running. */
+void
+frame_table_fork_page (struct thread *parent, struct supp_page *parent_entry,
+											 struct thread *child, struct supp_page *child_entry)
+{
+	struct frame_table_entry *frame;
+	uint8_t *upage = (uint8_t *) parent_entry->upage;
+
+	lock_acquire (&frame_table_lock);
+
+	/* Let a write by the pageout thread finish; it may evict the page,
+		so look the frame up again each time. */
+	for (;;)
+		{
+			frame = NULL;
+			if (parent_entry->is_loaded && !parent_entry->is_in_swap && !parent_entry->is_zero_mapped)
+				frame = find_frame (parent, upage);
+			if (frame == NULL || !frame->cleaning)
+				break;
+			cond_wait (&cleaned_cond, &frame_table_lock);
+		}
+
+	if (frame != NULL)
+		{
+			/* The copy in swap, if any, is older than a modified page. */
+			if (pagedir_is_dirty (parent->pagedir, upage) && !parent_entry->is_mmap)
+				{
+					parent_entry->is_anon = true;
+					if (parent_entry->has_swap_slot)
+						{
+							swap_table_free (parent_entry->block_page_idx);
+							parent_entry->has_swap_slot = false;
+						}
+				}
+			if (parent_entry->writable)
+				{
+					pagedir_clear_page (parent->pagedir, upage);
+					pagedir_set_page (parent->pagedir, upage, frame->kpage, false);
+					parent_entry->is_cow = true;
+				}
+		}
+	*child_entry = *parent_entry;
+	if (child_entry->has_swap_slot)
+		swap_table_dup (child_entry->block_page_idx);
+
+	if (child_entry->is_zero_mapped)
+		{
+			if (!pagedir_set_page (child->pagedir, upage, zero_frame, false))
+				child_entry->is_loaded = child_entry->is_zero_mapped = false;
+		}
+	else if (frame != NULL)
+		{
+			struct frame_mapping *m = malloc (sizeof *m);
+
+			if (m != NULL && pagedir_set_page (child->pagedir, upage, frame->kpage, false))
+				{
+					m->t = child;
+					m->upage = upage;
+					m->entry = child_entry;
+					m->frame = frame;
+					list_push_back (&frame->sharers, &m->elem);
+					list_push_back (&child->frame_mappings, &m->thread_elem);
+					child->rss++;
+				}
+			else
+				{
+					/* The child reads the page back from the executable, or fails. */
+					free (m);
+					child_entry->is_loaded = false;
+					child_entry->is_cow = false;
+				}
+		}
+	lock_release (&frame_table_lock);
+}
+
+/* Gives thread T a private, writable copy of its copy-on-write page
+	described by ENTRY, or just makes the page writable if no other
+	process maps it any more.  T keeps mapping the shared frame until
+	the copy is made, so that the frame can't be released meanwhile even
+	if every other process that maps it exits. */
+void
+frame_table_break_cow (struct thread *t, struct supp_page *entry)
+{
+	uint8_t *upage = (uint8_t *) entry->upage;
+	struct frame_table_entry *frame, *copy;
+
+	lock_acquire (&frame_table_lock);
+	while ((frame = find_frame (t, upage)) != NULL && frame->cleaning)
+		cond_wait (&cleaned_cond, &frame_table_lock);
+	ASSERT (frame != NULL);
+	entry->is_cow = false;
+	if (list_empty (&frame->sharers))
+		{
+			pagedir_clear_page (t->pagedir, upage);
+			pagedir_set_page (t->pagedir, upage, frame->kpage, true);
+			lock_release (&frame_table_lock);
+			return;
+		}
+
+	/* Keep the shared frame from being evicted until it is copied.  The
+		copy belongs to no process until it is mapped, so nothing else
+		touches it while the lock is released. */
+	frame->pin_cnt++;
+	copy = take_frame (t);
+	lock_release (&frame_table_lock);
+	memcpy (copy->kpage, frame->kpage, PGSIZE);
+	lock_acquire (&frame_table_lock);
+	frame->pin_cnt--;
+
+	/* The other processes may have exited meanwhile, leaving T the last. */
+	if (drop_mapping (frame, t, upage))
+		{
+			pagedir_clear_page (t->pagedir, upage);
+			release_frame (frame);
+		}
+	copy->t = t;
+	copy->upage = upage;
+	copy->entry = entry;
+	ASSERT (install_page (t, upage, copy->kpage, true));
+	list_push_back (&t->frame_list, &copy->owner_elem);
+	t->rss++;
+	lock_release (&frame_table_lock);
+}
+
+/* Frees the frame that holds user page UPAGE of thread T, first
+	writing it back to its file if it is a dirty memory-mapped page.
+	A shared frame is only unmapped from T while others still map it. */
+void
+frame_table_free_frame (struct thread *t, uint8_t *upage)
+{
+	struct frame_table_entry *frame;
+	struct supp_page *entry;
+
+	lock_acquire (&frame_table_lock);
+	frame = find_frame (t, upage);
+	if (frame != NULL)
+		{
+			/* Let a write by the pageout thread finish; it may evict the page. */
+			while (frame->cleaning)
+				cond_wait (&cleaned_cond, &frame_table_lock);
+			frame = find_frame (t, upage);
+		}
+
+	if (frame != NULL && !drop_mapping (frame, t, upage))
+		frame = NULL;
+	if (frame != NULL)
+		{
+			entry = supp_page_table_find_entry (&t->supp_page_table, (uintptr_t) upage);
+			if (entry != NULL && entry->is_mmap)
+				{
+					frame->pin_cnt++;
+					lock_release (&frame_table_lock);
+					write_back (frame, entry);
+					lock_acquire (&frame_table_lock);
+				}
+			pagedir_clear_page (t->pagedir, upage);
+			release_frame (frame);
+		}
 	lock_release (&frame_table_lock);
 }
 
-/* Clears all the physical frames of the current thread. */
+/* Clears all the physical frames of the current thread, visiting only
+	the frames it maps.  The pageout thread zeroes them afterward. */
 void
 frame_table_free_thread_frames ()
 {
 	struct thread *t = thread_current ();
-	int i;
 
 	lock_acquire(&frame_table_lock);
-	for (i = 0; i < MAX_USR_FRAME_NUM; ++i)
+	if (t->suspended)
 		{
-		if (frame_table[i].t == t)
-			{
-				memset (frame_table[i].kpage, 0, PGSIZE);
-				pagedir_clear_page (t->pagedir, frame_table[i].upage);
-				frame_table[i].t = NULL;
-				frame_table[i].upage = NULL;
-				frame_table[i].pin = true;
-			}
+			t->suspended = false;
+			suspended_cnt--;
 		}
+	while (!list_empty (&t->frame_list))
+		{
+			struct frame_table_entry *frame = list_entry (list_front (&t->frame_list),
+																										struct frame_table_entry, owner_elem);
+
+			/* Let a write by the pageout thread finish; it may evict the page. */
+			if (frame->cleaning)
+				cond_wait (&cleaned_cond, &frame_table_lock);
+			else if (drop_mapping (frame, t, frame->upage))
+				{
+					pagedir_clear_page (t->pagedir, frame->upage);
+					release_frame (frame);
+				}
+		}
+	while (!list_empty (&t->frame_mappings))
+		{
+			struct frame_mapping *m = list_entry (list_front (&t->frame_mappings),
+																						struct frame_mapping, thread_elem);
+			drop_mapping (m->frame, t, m->upage);
+		}
+	if (!list_empty (&unzeroed_frames))
+		cond_signal (&pageout_cond, &frame_table_lock);
 	lock_release (&frame_table_lock);
 }
 
@@ -97,12 +507,54 @@ frame_table_free_thread_frames ()
 void
 frame_table_destroy ()
 {
-	int i;
+	size_t i;
 
-	for (i = 0; i < MAX_USR_FRAME_NUM; ++i)
+	for (i = 0; i < unused_idx; ++i)
 		{
 			palloc_free_page (frame_table[i].kpage);
 		}
+	free (frame_table);
+}
+
+/* Zeroes a released frame and moves it to the free list, ahead of
+	the next page fault.  For the idle thread: it never blocks.
+	Interrupts are turned off meanwhile, so that no other thread can
+	want frame_table_lock while it is held; if the lock is already held,
+	gives up.  Returns true if a frame was zeroed. */
+bool
+frame_table_zero_free_frame (void)
+{
+	struct frame_table_entry *frame = NULL;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	if (frame_table != NULL && !list_empty (&unzeroed_frames)
+			&& lock_try_acquire (&frame_table_lock))
+		{
+			frame = list_entry (list_pop_front (&unzeroed_frames), struct frame_table_entry, free_elem);
+			memset (frame->kpage, 0, PGSIZE);
+			unzeroed_cnt--;
+			list_push_back (&free_frames, &frame->free_elem);
+			free_list_cnt++;
+			lock_release (&frame_table_lock);
+		}
+	intr_set_level (old_level);
+	return frame != NULL;
+}
+
+/* Blocks the current process while it is suspended to relieve memory
+	pressure.  Must be called with no locks held. */
+void
+frame_table_wait_if_suspended (void)
+{
+	struct thread *t = thread_current ();
+
+	if (!t->suspended)
+		return;
+	lock_acquire (&frame_table_lock);
+	while (t->suspended)
+		cond_wait (&resume_cond, &frame_table_lock);
+	lock_release (&frame_table_lock);
 }
 
 /* Adds a mapping from user virtual address UPAGE to kernel
@@ -123,51 +575,670 @@ install_page (struct thread *t, void *upage, void *kpage, bool writable)
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
 
-/* Performs an eviction given the NEW_UPAGE to be loaded. */
-static int
-do_eviction (struct thread *t, uint8_t *new_upage, bool writable)
+/* Takes a free frame for thread T, evicting a page if there is none,
+	and one of T's own pages first if T holds as many frames as its quota
+	allows.  Must be called with frame_table_lock held; it may be
+	released meanwhile. */
+static struct frame_table_entry *
+take_frame (struct thread *t)
 {
-	/* Get the victim index. */
-	int victim_index = get_victim ();
+	struct frame_table_entry *frame;
 
-	/* Find the corresponding supplemental page table entry. */
-	struct supp_page* entry = supp_page_table_find_entry (&(frame_table[victim_index].t->supp_page_table), frame_table[victim_index].upage);
+	if (t->frame_quota != 0 && t->rss >= t->frame_quota)
+		evict_frame (t);
+	while ((frame = get_free_frame ()) == NULL)
+		{
+			/* Every frame is pinned or being cleaned: let the other threads run. */
+			if (!evict_frame (NULL))
+				{
+					lock_release (&frame_table_lock);
+					thread_yield ();
+					lock_acquire (&frame_table_lock);
+				}
+		}
 
-	ASSERT (entry != NULL);
+	if (free_frame_cnt () < free_low)
+		cond_signal (&pageout_cond, &frame_table_lock);
+	return frame;
+}
+
+/* Takes a zeroed frame off the free list, or else obtains a new one
+	from the user pool, or else zeroes a released frame that the pageout
+	thread has not got to yet.  Returns NULL if there is none. */
+static struct frame_table_entry *
+get_free_frame (void)
+{
+	struct frame_table_entry *frame;
+
+	if (!list_empty (&free_frames))
+		{
+			free_list_cnt--;
+			return list_entry (list_pop_front (&free_frames), struct frame_table_entry, free_elem);
+		}
+	if (unused_idx < frame_cnt)
+		{
+			frame_table[unused_idx].kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+			if (frame_table[unused_idx].kpage != NULL)
+				return &frame_table[unused_idx++];
+
+			/* The user pool is smaller than expected; stop counting on the rest. */
+			frame_cnt = unused_idx;
+		}
+	if (!list_empty (&unzeroed_frames))
+		{
+			unzeroed_cnt--;
+			frame = list_entry (list_pop_front (&unzeroed_frames), struct frame_table_entry, free_elem);
+			memset (frame->kpage, 0, PGSIZE);
+			return frame;
+		}
+	return NULL;
+}
+
+/* Clears FRAME and puts it on the list of frames to zero. */
+static void
+release_frame (struct frame_table_entry *frame)
+{
+	if (frame->t != NULL)
+		{
+			list_remove (&frame->owner_elem);
+			frame->t->rss--;
+		}
+	frame->t = NULL;
+	frame->upage = NULL;
+	frame->entry = NULL;
+	frame->pin_cnt = 0;
+	ASSERT (list_empty (&frame->sharers));
+	if (frame->inode != NULL)
+		{
+			hash_delete (&shared_frames, &frame->share_elem);
+			frame->inode = NULL;
+		}
+	if (frame->clean_queued)
+		{
+			list_remove (&frame->clean_elem);
+			frame->clean_queued = false;
+		}
+	list_push_back (&unzeroed_frames, &frame->free_elem);
+	unzeroed_cnt++;
+}
+
+/* Returns the number of frames that can be handed out without eviction. */
+static size_t
+free_frame_cnt (void)
+{
+	return free_list_cnt + unzeroed_cnt + (frame_cnt - unused_idx);
+}
+
+/* Zeroes the released frames and moves them to the free list, so
+	that page faults find zeroed frames ready.  Must be called with
+	frame_table_lock held; it is released while each frame is zeroed. */
+static void
+zero_free_frames (void)
+{
+	while (!list_empty (&unzeroed_frames))
+		{
+			struct frame_table_entry *frame;
+
+			frame = list_entry (list_pop_front (&unzeroed_frames), struct frame_table_entry, free_elem);
+			lock_release (&frame_table_lock);
+			memset (frame->kpage, 0, PGSIZE);
+			lock_acquire (&frame_table_lock);
+			unzeroed_cnt--;
+			list_push_back (&free_frames, &frame->free_elem);
+			free_list_cnt++;
+		}
+}
+
+/* Evicts a page and puts its frame on the free list; if ONLY is
+	nonnull, one of ONLY's pages.  Returns false if there was no page
+	to evict, or if the owner wrote the page while it was being written
+	out, in which case it stays where it is.  Must be called with
+	frame_table_lock held. */
+static bool
+evict_frame (struct thread *only)
+{
+	struct frame_table_entry *frame;
+	struct supp_page *entry;
+	struct thread *owner;
+	enum intr_level old_level;
+	bool redirtied;
+	int victim_index;
+
+	victim_index = get_victim (only);
+	if (!list_empty (&clean_queue))
+		cond_signal (&pageout_cond, &frame_table_lock);
+	if (victim_index < 0)
+		return false;
+	frame = &frame_table[victim_index];
+	owner = frame->t;
+
+	entry = frame->entry;
 
-	/* If the page is dirty, swap it out to the swap disk, otherwise just unload it. */
-	if (pagedir_is_dirty (frame_table[victim_index].t->pagedir, frame_table[victim_index].upage) || entry->is_stack)
+	/* A page that needs writing out but holds only zeros is dropped
+		instead; its next access maps the zero frame again.  Interrupts
+		are off so the owner can't write the page while it is checked. */
+	if (!entry->is_mmap && list_empty (&frame->sharers) && frame_is_dirty (frame, entry))
 		{
-			entry->block_page_idx = swap_table_swap_out (frame_table[victim_index].upage);
-			entry->is_in_swap = true;
+			bool had_swap_slot = false;
+			bool zero;
+
+			old_level = intr_disable ();
+			zero = page_is_zero (frame->kpage);
+			if (zero)
+				{
+					pagedir_clear_page (owner->pagedir, frame->upage);
+					had_swap_slot = entry->has_swap_slot;
+					entry->has_swap_slot = false;
+					entry->is_anon = false;
+					entry->page_read_bytes = 0;
+					entry->is_loaded = false;
+					entry->is_cow = false;
+				}
+			intr_set_level (old_level);
+
+			if (zero)
+				{
+					if (had_swap_slot)
+						swap_table_free (entry->block_page_idx);
+					release_frame (frame);
+					return true;
+				}
+		}
+
+	/* Only a not-accessed dirty page was found: write it out now. */
+	if (frame_is_dirty (frame, entry) && !clean_frame (frame, entry))
+		return false;
+
+	/* Sharers of a copy-on-write page will find it in the same slot. */
+	if (!entry->is_mmap && entry->is_anon)
+		{
+			struct list_elem *e;
+
+			for (e = list_begin (&frame->sharers); e != list_end (&frame->sharers); e = list_next (e))
+				{
+					struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+
+					if (m->entry->has_swap_slot)
+						{
+							if (m->entry->block_page_idx == entry->block_page_idx)
+								continue;
+							swap_table_free (m->entry->block_page_idx);
+						}
+					swap_table_dup (entry->block_page_idx);
+				}
 		}
+
+	/* Unmap the page and record where it went, unless the owner has
+		dirtied it again.  Interrupts are off so the owner can't fault on
+		the page before its entry says where it is.  A memory-mapped or
+		unmodified executable page is reread from its file; anything else
+		is in swap. */
+	old_level = intr_disable ();
+	redirtied = pagedir_is_dirty (owner->pagedir, frame->upage);
+	if (!redirtied)
+		{
+			pagedir_clear_page (owner->pagedir, frame->upage);
+			if (!entry->is_mmap && entry->is_anon)
+				entry->is_in_swap = true;
+			else
+				entry->is_loaded = false;
+			entry->is_cow = false;
+			unmap_sharers (frame, entry);
+		}
+	intr_set_level (old_level);
+
+	if (redirtied)
+		return false;
+	free_sharers (frame);
+	release_frame (frame);
+	return true;
+}
+
+/* Returns true if the page in FRAME, described by ENTRY, has to be
+	written out before the frame can be reused: it is dirty, or it is
+	an anonymous page with no copy in swap. */
+static bool
+frame_is_dirty (struct frame_table_entry *frame, struct supp_page *entry)
+{
+	if (pagedir_is_dirty (frame->t->pagedir, frame->upage))
+		return true;
+	return !entry->is_mmap && entry->is_anon && !entry->has_swap_slot;
+}
+
+/* Returns true if the page at KPAGE holds only zeros. */
+static bool
+page_is_zero (const uint8_t *kpage)
+{
+	const uint32_t *word = (const uint32_t *) kpage;
+	size_t i;
+
+	for (i = 0; i < PGSIZE / sizeof *word; i++)
+		if (word[i] != 0)
+			return false;
+	return true;
+}
+
+/* Writes the page in FRAME, described by ENTRY, to its file or to
+	swap, leaving it mapped and clean.  Returns false if the owner
+	wrote the page while it was being written.
+
+	Must be called with frame_table_lock held.  The lock is released
+	while the page is written out, so the frame is pinned and marked as
+	being cleaned meanwhile.  The page stays mapped, so its owner keeps
+	running; its dirty bit is cleared beforehand to tell whether the
+	owner wrote the page during the write. */
+static bool
+clean_frame (struct frame_table_entry *frame, struct supp_page *entry)
+{
+	struct thread *owner = frame->t;
+	enum intr_level old_level;
+	uint32_t swap_idx = 0;
+	bool redirtied;
+
+	/* A modified page can't be reread from the executable any more,
+		and its old copy in swap is stale. */
+	if (!entry->is_mmap)
+		{
+			entry->is_anon = true;
+			if (entry->has_swap_slot)
+				{
+					swap_table_free (entry->block_page_idx);
+					entry->has_swap_slot = false;
+				}
+		}
+
+	frame->pin_cnt++;
+	frame->cleaning = true;
+	pagedir_set_dirty (owner->pagedir, frame->upage, false);
+	lock_release (&frame_table_lock);
+
+	if (entry->is_mmap)
+		file_write_at (entry->file, frame->kpage, entry->page_read_bytes, entry->offset);
 	else
+		swap_idx = swap_table_swap_out (frame->kpage);
+
+	lock_acquire (&frame_table_lock);
+	frame->pin_cnt--;
+	frame->cleaning = false;
+	cond_broadcast (&cleaned_cond, &frame_table_lock);
+
+	old_level = intr_disable ();
+	redirtied = pagedir_is_dirty (owner->pagedir, frame->upage);
+	if (!entry->is_mmap && !redirtied)
 		{
-			entry->is_loaded = false;
+			entry->block_page_idx = swap_idx;
+			entry->has_swap_slot = true;
 		}
+	intr_set_level (old_level);
 
-	/* Clear out the victim page and load in the new page. */
-	memset (frame_table[victim_index].kpage, 0, PGSIZE);
-	pagedir_clear_page (frame_table[victim_index].t->pagedir, frame_table[victim_index].upage);
-	frame_table[victim_index].t = t;
-	frame_table[victim_index].upage = new_upage;
-	frame_table[victim_index].pin = false;
-	ASSERT (install_page (t, new_upage, frame_table[victim_index].kpage, writable));
+	if (!entry->is_mmap && redirtied)
+		swap_table_free (swap_idx);
+	return !redirtied;
+}
 
-	return victim_index;
+/* Writes out the frames queued by get_victim() that are still dirty
+	and not recently used.  Must be called with frame_table_lock held. */
+static void
+clean_queued_frames (void)
+{
+	while (!list_empty (&clean_queue))
+		{
+			struct frame_table_entry *frame;
+			struct supp_page *entry;
 
+			frame = list_entry (list_pop_front (&clean_queue), struct frame_table_entry, clean_elem);
+			frame->clean_queued = false;
+			if (frame->t == NULL || frame->pin_cnt > 0
+					|| pagedir_is_accessed (frame->t->pagedir, frame->upage))
+				continue;
+			entry = frame->entry;
+			if (frame_is_dirty (frame, entry))
+				clean_frame (frame, entry);
+		}
 }
 
-/* Returns the index of the victim to evict from the frame table. (Clock replacement)*/
+/* Writes FRAME back to its file if ENTRY says it is a memory-mapped page and the page is dirty. */
+static void
+write_back (struct frame_table_entry *frame, struct supp_page *entry)
+{
+	if (entry->is_mmap && pagedir_is_dirty (frame->t->pagedir, frame->upage))
+		{
+			file_write_at (entry->file, frame->kpage, entry->page_read_bytes, entry->offset);
+			pagedir_set_dirty (frame->t->pagedir, frame->upage, false);
+		}
+}
+
+/* Returns the index of the victim to evict from the frame table, or
+	-1 if every frame is free or pinned.  If ONLY is nonnull, only
+	ONLY's frames are considered.  This is an enhanced clock: an
+	accessed page gets a second chance, unless its process is
+	suspended, a not-accessed clean page is taken right away, and a
+	not-accessed dirty page is queued for the pageout thread to clean
+	and taken only if no clean page turns up.  Each revolution of the
+	hand ends an interval of the working set estimate. */
 static int
-get_victim ()
+get_victim (struct thread *only)
+{
+	int dirty_victim = -1;
+	size_t tries;
+
+	/* Two sweeps: the first may only clear accessed bits. */
+	for (tries = 0; tries < 2 * unused_idx; ++tries)
+		{
+			int victim = (next_victim++) % unused_idx;
+			struct frame_table_entry *frame = &frame_table[victim];
+			struct supp_page *entry;
+
+			if (victim == 0)
+				update_working_sets ();
+			if (frame->t == NULL || frame->pin_cnt > 0 || (only != NULL && frame->t != only))
+				continue;
+			if (frame_is_accessed (frame) && !frame->t->suspended)
+				continue;
+
+			entry = frame->entry;
+			if (!frame_is_dirty (frame, entry))
+				return victim;
+			if (dirty_victim < 0)
+				dirty_victim = victim;
+			if (!frame->clean_queued)
+				{
+					list_push_back (&clean_queue, &frame->clean_elem);
+					frame->clean_queued = true;
+				}
+		}
+	return dirty_victim;
+}
+
+/* Keeps free frames between the low and high watermarks, so that page
+	faults normally find a frame ready instead of waiting for an
+	eviction, writes out the dirty pages the clock passed over, and
+	zeroes the frames released by eviction and by exiting processes.
+	While a process is suspended, it also samples the working sets
+	regularly, since the clock may stop turning once the remaining
+	processes fit in memory. */
+static void
+pageout_thread (void *aux UNUSED)
+{
+	lock_acquire (&frame_table_lock);
+	for (;;)
+		{
+			if (suspended_cnt > 0)
+				{
+					lock_release (&frame_table_lock);
+					timer_sleep (WS_SAMPLE_TICKS);
+					lock_acquire (&frame_table_lock);
+					sample_working_sets ();
+				}
+			else
+				cond_wait (&pageout_cond, &frame_table_lock);
+			clean_queued_frames ();
+			while (free_frame_cnt () < free_high && evict_frame (NULL))
+				continue;
+			clean_queued_frames ();
+			zero_free_frames ();
+		}
+}
+
+/* Returns the frame mapped at UPAGE of thread T, by T itself or as
+	one of its sharers, or a null pointer if there is none.  Must be
+	called with frame_table_lock held. */
+static struct frame_table_entry *
+find_frame (struct thread *t, uint8_t *upage)
+{
+	struct list_elem *e;
+
+	for (e = list_begin (&t->frame_list); e != list_end (&t->frame_list); e = list_next (e))
+		{
+			struct frame_table_entry *frame = list_entry (e, struct frame_table_entry, owner_elem);
+			if (frame->upage == upage)
+				return frame;
+		}
+	for (e = list_begin (&t->frame_mappings); e != list_end (&t->frame_mappings); e = list_next (e))
+		{
+			struct frame_mapping *m = list_entry (e, struct frame_mapping, thread_elem);
+			if (m->upage == upage)
+				return m->frame;
+		}
+	return NULL;
+}
+
+/* Removes thread T's mapping at UPAGE from FRAME's list of mappings.
+	Returns true if that was the last one, in which case the caller
+	must unmap the page and release the frame.  Otherwise the page is
+	unmapped here, and if T was the frame's T, a sharer takes its
+	place.  Must be called with frame_table_lock held. */
+static bool
+drop_mapping (struct frame_table_entry *frame, struct thread *t, uint8_t *upage)
+{
+	struct frame_mapping *m = NULL;
+	struct list_elem *e;
+
+	if (list_empty (&frame->sharers))
+		return true;
+
+	if (frame->t == t && frame->upage == upage)
+		{
+			m = list_entry (list_pop_front (&frame->sharers), struct frame_mapping, elem);
+			list_remove (&frame->owner_elem);
+			frame->t = m->t;
+			frame->upage = m->upage;
+			frame->entry = m->entry;
+			list_push_back (&m->t->frame_list, &frame->owner_elem);
+		}
+	else
+		for (e = list_begin (&frame->sharers); e != list_end (&frame->sharers); e = list_next (e))
+			{
+				m = list_entry (e, struct frame_mapping, elem);
+				if (m->t == t && m->upage == upage)
+					{
+						list_remove (e);
+						break;
+					}
+			}
+	list_remove (&m->thread_elem);
+	pagedir_clear_page (t->pagedir, upage);
+	t->rss--;
+	free (m);
+	return false;
+}
+
+/* Returns true if any process that maps FRAME has accessed it since
+	the last call, and clears their accessed bits.  Each such process
+	has the page counted in its working set. */
+static bool
+frame_is_accessed (struct frame_table_entry *frame)
+{
+	bool accessed = false;
+	struct list_elem *e;
+
+	if (pagedir_is_accessed (frame->t->pagedir, frame->upage))
+		{
+			pagedir_set_accessed (frame->t->pagedir, frame->upage, false);
+			frame->t->ws_refs++;
+			accessed = true;
+		}
+	for (e = list_begin (&frame->sharers); e != list_end (&frame->sharers); e = list_next (e))
+		{
+			struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+			if (pagedir_is_accessed (m->t->pagedir, m->upage))
+				{
+					pagedir_set_accessed (m->t->pagedir, m->upage, false);
+					m->t->ws_refs++;
+					accessed = true;
+				}
+		}
+	return accessed;
+}
+
+/* Unmaps FRAME from every sharer.  Their pages go where ENTRY, the
+	entry of the frame's T, says its page went: to the same swap slot,
+	already referenced once for each sharer, or back to the executable.
+	Must be called with interrupts off; free_sharers() must be called
+	after they are turned back on. */
+static void
+unmap_sharers (struct frame_table_entry *frame, struct supp_page *entry)
+{
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (e = list_begin (&frame->sharers); e != list_end (&frame->sharers); e = list_next (e))
+		{
+			struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+
+			pagedir_clear_page (m->t->pagedir, m->upage);
+			list_remove (&m->thread_elem);
+			m->t->rss--;
+			m->entry->is_cow = false;
+			if (!entry->is_mmap && entry->is_anon)
+				{
+					m->entry->is_anon = true;
+					m->entry->has_swap_slot = true;
+					m->entry->block_page_idx = entry->block_page_idx;
+					m->entry->is_in_swap = true;
+				}
+			else
+				m->entry->is_loaded = false;
+		}
+}
+
+/* Frees FRAME's sharers list, once unmap_sharers() has unmapped them. */
+static void
+free_sharers (struct frame_table_entry *frame)
 {
-	int victim = (next_victim++) % MAX_USR_FRAME_NUM;
-	/* Do not get victim that is pineed or accessed recently (set accessed bit to zero if accessed recently) */
-	while (frame_table[victim].pin == true || pagedir_is_accessed (frame_table[victim].t->pagedir, frame_table[victim].upage) )
+	while (!list_empty (&frame->sharers))
+		free (list_entry (list_pop_front (&frame->sharers), struct frame_mapping, elem));
+}
+
+/* Totals over the user processes, gathered by update_working_sets(). */
+struct ws_totals
 	{
-		pagedir_set_accessed (frame_table[victim].t->pagedir, frame_table[victim].upage, false);
-		victim = (next_victim++) % MAX_USR_FRAME_NUM;
-	}
-	return victim;
-}
\ No newline at end of file
+		size_t room;				/* Frames available to user processes. */
+		size_t demand;				/* Sum of the running processes' working sets. */
+		size_t running;				/* Number of processes not suspended. */
+		struct thread *lowest;		/* Lowest-priority running process. */
+		struct thread *waiting;		/* Highest-priority suspended process. */
+	};
+
+/* Ends the working set interval of process T: its estimate moves
+	halfway toward the number of pages it was found using.  The estimate
+	of a suspended process is kept as it was when it was suspended. */
+static void
+age_working_set (struct thread *t, void *totals_)
+{
+	struct ws_totals *totals = totals_;
+
+	if (t->pagedir == NULL)
+		return;
+	if (t->suspended)
+		{
+			if (totals->waiting == NULL || t->priority > totals->waiting->priority)
+				totals->waiting = t;
+			return;
+		}
+	t->wss = (t->wss + t->ws_refs) / 2;
+	t->ws_refs = 0;
+	totals->demand += t->wss;
+	totals->running++;
+	if (totals->lowest == NULL || t->priority < totals->lowest->priority
+			|| (t->priority == totals->lowest->priority && t->wss > totals->lowest->wss))
+		totals->lowest = t;
+}
+
+/* Gives process T a share of the frames in proportion to its working
+	set, if the working sets don't all fit, or else no limit. */
+static void
+set_frame_quota (struct thread *t, void *totals_)
+{
+	struct ws_totals *totals = totals_;
+	size_t quota;
+
+	if (t->pagedir == NULL)
+		return;
+	if (totals->demand <= totals->room)
+		t->frame_quota = 0;
+	else
+		{
+			quota = totals->room * t->wss / totals->demand;
+			t->frame_quota = quota > QUOTA_MIN_FRAMES ? quota : QUOTA_MIN_FRAMES;
+		}
+}
+
+/* Ends a working set interval for every process, then suspends the
+	lowest-priority process if the working sets of the running ones
+	don't fit in memory, or resumes a suspended process if its working
+	set fits again, and recomputes the frame quotas.  One process at
+	most is suspended or resumed per interval, and the last running
+	one is never suspended.  Must be called with frame_table_lock
+	held. */
+static void
+update_working_sets (void)
+{
+	struct ws_totals totals;
+	enum intr_level old_level;
+	bool resumed = false;
+
+	/* A tiny pool may hold no more frames than the pageout thread
+	   keeps free. */
+	totals.room = frame_cnt > free_high ? frame_cnt - free_high : 0;
+	totals.demand = totals.running = 0;
+	totals.lowest = totals.waiting = NULL;
+
+	old_level = intr_disable ();
+	thread_foreach (age_working_set, &totals);
+	if (totals.demand > totals.room && totals.running > 1)
+		{
+			totals.lowest->suspended = true;
+			totals.demand -= totals.lowest->wss;
+			suspended_cnt++;
+		}
+	else if (totals.waiting != NULL
+					 && (totals.running == 0 || totals.demand + totals.waiting->wss <= totals.room))
+		{
+			totals.waiting->suspended = false;
+			totals.demand += totals.waiting->wss;
+			suspended_cnt--;
+			resumed = true;
+		}
+	thread_foreach (set_frame_quota, &totals);
+	intr_set_level (old_level);
+
+	if (resumed)
+		cond_broadcast (&resume_cond, &frame_table_lock);
+}
+
+/* Counts the pages in use toward their processes' working sets and
+	ends the interval, for when the clock is not turning.  Must be
+	called with frame_table_lock held. */
+static void
+sample_working_sets (void)
+{
+	size_t i;
+
+	for (i = 0; i < unused_idx; ++i)
+		if (frame_table[i].t != NULL)
+			frame_is_accessed (&frame_table[i]);
+	update_working_sets ();
+}
+
+/* Returns a hash value for shared frame F. */
+static unsigned
+shared_frame_hash (const struct hash_elem *f_, void *aux UNUSED)
+{
+	const struct frame_table_entry *f = hash_entry (f_, struct frame_table_entry, share_elem);
+	return hash_bytes (&f->inode, sizeof f->inode) ^ hash_int (f->offset);
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+shared_frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                   void *aux UNUSED)
+{
+	const struct frame_table_entry *a = hash_entry (a_, struct frame_table_entry, share_elem);
+	const struct frame_table_entry *b = hash_entry (b_, struct frame_table_entry, share_elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->offset < b->offset;
+}
@@ -1,18 +1,61 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include "filesys/off_t.h"
 #include "threads/synch.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 
+struct inode;
+struct supp_page;
+
 struct frame_table_entry
 {
 	struct thread *t;	/* Process that is using the frame. */
 	uint8_t *upage;		/* Virtual page address that is possibly mapped to the frame. */
+	struct supp_page *entry;	/* T's entry for UPAGE, so T's table is never searched by others. */
 	uint8_t *kpage;		/* Physical address of the frame. */
-	bool pin;					/* If the frame is currently pinned. */
+	unsigned pin_cnt;			/* Number of reasons the frame must not be evicted. */
+	bool cleaning;				/* If the frame is being written out for eviction. */
+	struct list_elem free_elem;	/* Element in the free frame list, if unused. */
+	bool clean_queued;			/* If the frame is in the queue of frames to clean. */
+	struct list_elem clean_elem;	/* Element in the queue of frames to clean. */
+	struct inode *inode;		/* Executable the read-only page came from, if shared. */
+	off_t offset;				/* Offset of the page in INODE, if shared. */
+	struct hash_elem share_elem;	/* Element in the shared frames table, if shared. */
+	struct list sharers;		/* Mappings besides T's, as struct frame_mapping. */
+	struct list_elem owner_elem;	/* Element in T's frame_list. */
+};
+
+/* A process other than the first one that maps a shared frame. */
+struct frame_mapping
+{
+	struct thread *t;			/* Process mapping the frame. */
+	uint8_t *upage;				/* Where the process maps it. */
+	struct supp_page *entry;	/* The process's page table entry for UPAGE. */
+	struct frame_table_entry *frame;	/* The frame mapped. */
+	struct list_elem elem;		/* Element in the frame's sharers list. */
+	struct list_elem thread_elem;	/* Element in T's frame_mappings. */
 };
 
 /* Function declaractions. */
 void frame_table_init (void);
 int frame_table_assign_frame (struct thread *t, uint8_t *upage, bool writable, bool pin);
 void frame_table_unpin_frame (int index);
+bool frame_table_pin_page (struct thread *t, uint8_t *upage);
+void frame_table_unpin_page (struct thread *t, uint8_t *upage);
+size_t frame_table_spare_frames (void);
+bool frame_table_map_shared (struct thread *t, uint8_t *upage, struct inode *inode, off_t offset);
+void frame_table_share_frame (int index, struct inode *inode, off_t offset);
+void frame_table_fork_page (struct thread *parent, struct supp_page *parent_entry,
+														struct thread *child, struct supp_page *child_entry);
+void frame_table_break_cow (struct thread *t, struct supp_page *entry);
+void frame_table_free_frame (struct thread *t, uint8_t *upage);
 void frame_table_free_thread_frames (void);
+void frame_table_wait_if_suspended (void);
+bool frame_table_zero_free_frame (void);
 void frame_table_destroy (void);
+uint8_t *frame_table_zero_frame (void);
+
+#endif /* vm/frame.h */
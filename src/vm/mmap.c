@@ -0,0 +1,114 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+#include "vm/vma.h"
+
+static struct mmap_file *find_mapping (mapid_t mapid);
+static void unmap (struct mmap_file *m);
+
+/* Maps FILE into the current process's address space starting at
+   ADDR.  Only a region for the mapping is added here; each page is
+   read in when first touched.
+   Returns the new mapping's identifier, or MAP_FAILED if FILE is
+   empty, ADDR is not page-aligned, or any page of the mapping
+   would overlap pages already in use. */
+mapid_t
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *cur = thread_current ();
+  struct mmap_file *m;
+  off_t length;
+  size_t page_cnt;
+
+  if (file == NULL || addr == NULL || pg_ofs (addr) != 0)
+    return MAP_FAILED;
+  length = file_length (file);
+  if (length == 0)
+    return MAP_FAILED;
+
+  /* Check that the whole range is user address space.  vma_add()
+     checks that no other region uses it. */
+  page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  if ((uintptr_t) addr + page_cnt * PGSIZE > (uintptr_t) PHYS_BASE
+      || (uintptr_t) addr + page_cnt * PGSIZE < (uintptr_t) addr)
+    return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->vma = vma_add (&cur->vma_list, (uintptr_t) addr,
+                    (uintptr_t) addr + page_cnt * PGSIZE, VMA_MMAP, true,
+                    m->file, 0, length);
+  if (m->vma == NULL)
+    {
+      file_close (m->file);
+      free (m);
+      return MAP_FAILED;
+    }
+  m->mapid = cur->next_mapid++;
+  list_push_back (&cur->mmap_list, &m->elem);
+
+  return m->mapid;
+}
+
+/* Unmaps mapping MAPID of the current process, writing its dirty
+   pages back to the file.  Does nothing if there is no such
+   mapping. */
+void
+mmap_unmap (mapid_t mapid)
+{
+  struct mmap_file *m = find_mapping (mapid);
+  if (m != NULL)
+    unmap (m);
+}
+
+/* Unmaps all of the current process's mappings, as on exit. */
+void
+mmap_unmap_all (void)
+{
+  struct list *mmap_list = &thread_current ()->mmap_list;
+
+  while (!list_empty (mmap_list))
+    unmap (list_entry (list_front (mmap_list), struct mmap_file, elem));
+}
+
+/* Returns the current process's mapping MAPID, or a null pointer
+   if there is none. */
+static struct mmap_file *
+find_mapping (mapid_t mapid)
+{
+  struct list *mmap_list = &thread_current ()->mmap_list;
+  struct list_elem *e;
+
+  for (e = list_begin (mmap_list); e != list_end (mmap_list);
+       e = list_next (e))
+    {
+      struct mmap_file *m = list_entry (e, struct mmap_file, elem);
+      if (m->mapid == mapid)
+        return m;
+    }
+  return NULL;
+}
+
+/* Removes mapping M and frees it.  Its region is torn down as a
+   whole: only the pages that were touched have entries to remove. */
+static void
+unmap (struct mmap_file *m)
+{
+  supp_page_table_remove_region (&thread_current ()->supp_page_table,
+                                 m->vma);
+  vma_remove (m->vma);
+  list_remove (&m->elem);
+  file_close (m->file);
+  free (m);
+}
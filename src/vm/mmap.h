@@ -0,0 +1,23 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/thread.h"
+
+struct vma;
+
+/* A file mapped into a process's address space. */
+struct mmap_file
+  {
+    struct list_elem elem;              /* Element in thread's mmap_list. */
+    mapid_t mapid;                      /* Mapping identifier. */
+    struct file *file;                  /* Own handle on the mapped file. */
+    struct vma *vma;                    /* The mapping's region. */
+  };
+
+mapid_t mmap_map (struct file *, void *addr);
+void mmap_unmap (mapid_t);
+void mmap_unmap_all (void);
+
+#endif /* vm/mmap.h */
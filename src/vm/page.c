@@ -1,5 +1,9 @@
 #include <debug.h>
 #include <hash.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
 #include "threads/vaddr.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
@@ -7,12 +11,28 @@
 #include "vm/frame.h"
 #include "vm/page.h"
 #include "vm/swap.h"
+#include "vm/vma.h"
 
-static bool supp_page_table_load_page (struct hash *table, struct supp_page *entry);
+static bool supp_page_table_load_page (struct hash *table, struct supp_page *entry, bool write);
+static bool unshare_zero_page (struct supp_page *entry);
+static bool map_shared_page (struct supp_page *entry);
+static bool read_page (struct supp_page *entry);
+static void install_read_page (struct supp_page *entry, const uint8_t *data);
+static void fault_around (struct hash *table, struct supp_page *entry);
+static void read_run (struct hash *table, uintptr_t start, size_t page_cnt);
+static struct supp_page *get_entry (struct hash *table, uintptr_t upage);
 static void supp_page_table_destructor (struct hash_elem *e, void *aux);
 static unsigned page_hash (const struct hash_elem *p_, void *aux UNUSED);
 static bool page_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED);
 static void swap_in_page_from_disk (struct supp_page* entry);
+static bool is_stack_access (const void *fault_addr, const void *esp);
+static bool grow_stack (struct hash *table, uintptr_t upage, bool write);
+
+/* Maximum size of a process's stack, in pages. */
+size_t stack_page_limit = STACK_PAGE_LIMIT_DEFAULT;
+
+/* Number of executable pages mapped by one page fault. */
+size_t fault_around_pages = FAULT_AROUND_DEFAULT;
 
 
 /* Initialization of a supplemental page table. */
@@ -21,36 +41,57 @@ void supp_page_table_init (struct hash *table)
 	ASSERT (hash_init (table, page_hash, page_less, NULL) );
 }
 
-/* Add a new supplemental page table entry. */
-void
-supp_page_table_insert (struct hash *table, uintptr_t upage, size_t page_read_bytes, bool writable, off_t offset, bool is_stack)
+/* Add a new supplemental page table entry for page UPAGE of region
+	V, which says where the page's data comes from.  A page of a
+	memory-mapped file must be written back to its file rather than
+	swapped.  IS_STACK is true for the first page of the stack, which is
+	loaded right away.  Returns the new entry, or a null pointer if
+	memory runs out. */
+struct supp_page *
+supp_page_table_insert (struct hash *table, struct vma *v, uintptr_t upage, bool is_stack)
 {
 	ASSERT (upage % PGSIZE == 0);
 
 	struct supp_page *supp_page_entry = (struct supp_page*) malloc (sizeof (struct supp_page));
+	size_t page_read_bytes;
+	off_t offset;
 
+	if (supp_page_entry == NULL)
+		return NULL;
+	vma_page (v, upage, &offset, &page_read_bytes);
 	supp_page_entry->upage = upage;
 	supp_page_entry->page_read_bytes = page_read_bytes;
-	supp_page_entry->writable = writable;
+	supp_page_entry->writable = v->writable;
 	if (is_stack)
 		supp_page_entry->is_loaded = true;
 	else
 		supp_page_entry->is_loaded = false;
 	supp_page_entry->is_in_swap = false;
 	supp_page_entry->is_stack = is_stack;
+	supp_page_entry->is_zero_mapped = false;
+	supp_page_entry->is_cow = false;
+	supp_page_entry->is_anon = is_stack;
+	supp_page_entry->has_swap_slot = false;
 	supp_page_entry->offset = offset;
+	supp_page_entry->file = v->file;
+	supp_page_entry->is_mmap = v->type == VMA_MMAP;
 	hash_insert (table, &supp_page_entry->hash_elem);
+	list_push_back (&v->pages, &supp_page_entry->vma_elem);
+	return supp_page_entry;
 }
 
-/* Inspects supplemental page table TABLE given the virtual address VADDR. 
+/* Inspects supplemental page table TABLE given the virtual address VADDR,
+		which the process tried to write if WRITE is true.
 		If the page in that entry is not loaded yet, load it. If the page is
-		in the swap disk, swap it back to main memory.
+		in the swap disk, swap it back to main memory.  If the page maps the
+		shared zero frame or is shared copy-on-write and is being written,
+		give it a frame of its own.
 		If the page is successfully loaded (from either swap disk or filesys), 
 		return true, else return false. */
 bool
-supp_page_table_inspect (struct hash *table, uintptr_t vaddr)
+supp_page_table_inspect (struct hash *table, uintptr_t vaddr, bool write)
 {
-	struct supp_page *entry = supp_page_table_find_entry (table, pg_round_down (vaddr));
+	struct supp_page *entry = supp_page_table_find_entry (table, (uintptr_t) pg_round_down ((void *) vaddr));
 
 	if (entry == NULL)
 		{
@@ -61,7 +102,7 @@ supp_page_table_inspect (struct hash *table, uintptr_t vaddr)
 			/* If the page is not loaded yet and not swapped into the disk, load it */
 			if (!entry->is_loaded && !entry->is_in_swap)
 				{
-					return supp_page_table_load_page (table, entry);
+					return supp_page_table_load_page (table, entry, write);
 				}
 
 			/* If the page is swapped out, swapped it back. */
@@ -71,35 +112,143 @@ supp_page_table_inspect (struct hash *table, uintptr_t vaddr)
 					return true;
 				}
 
-			/* If the page is in memory and is being inspected, this means that the process tries to write to non-writeable memory,
-				terminate the process. */
-			else if (entry->is_loaded && !entry->is_in_swap)
+			/* A store to a page that still maps the zero frame copies it. */
+			else if (write && entry->is_zero_mapped && entry->writable)
 				{
-					exit (-1);
+					return unshare_zero_page (entry);
 				}
 
-			NOT_REACHED ();
+			/* A store to a page shared with a forked process copies it. */
+			else if (write && entry->is_cow && entry->writable)
+				{
+					frame_table_break_cow (thread_current (), entry);
+					return true;
+				}
+
+			/* If the page is in memory and is being inspected, this means that the process tries to write to non-writeable memory. */
 			return false;
 		}
 }
 
+/* Handles a fault on user address FAULT_ADDR of the current process,
+	whose user stack pointer is ESP; WRITE is true if the access was a
+	write.  A page in one of the process's regions is loaded from its
+	file or from swap; an access just below the stack grows the stack
+	down to that page.  Returns true if the faulting access can be
+	retried, false if it was a bad access. */
+bool
+supp_page_table_fault (struct hash *table, const void *fault_addr, const void *esp, bool write)
+{
+	uintptr_t upage = (uintptr_t) pg_round_down (fault_addr);
+
+	if (fault_addr == NULL || !is_user_vaddr (fault_addr))
+		return false;
+	if (get_entry (table, upage) != NULL)
+		return supp_page_table_inspect (table, (uintptr_t) fault_addr, write);
+	if (is_stack_access (fault_addr, esp))
+		return grow_stack (table, upage, write);
+	return false;
+}
+
+/* Makes sure that the current process's page at UADDR stays in
+	memory, so that the kernel can access it without faulting, until
+	supp_page_table_unpin() is called: the page is loaded, or the stack
+	grown to it, as for a fault with user stack pointer ESP, and its
+	frame is pinned.  If WRITE is true, the page gets a frame of its own
+	if it is shared, since the kernel is about to write it.  Returns
+	false if UADDR is a bad address, or a read-only one and WRITE is
+	true. */
+bool
+supp_page_table_pin (struct hash *table, const void *uaddr, const void *esp, bool write)
+{
+	struct thread *t = thread_current ();
+	uint8_t *upage = pg_round_down (uaddr);
+
+	/* Loop in case the page is evicted again before it is pinned. */
+	for (;;)
+		{
+			struct supp_page *entry = supp_page_table_find_entry (table, (uintptr_t) upage);
+
+			if (entry != NULL && pagedir_get_page (t->pagedir, upage) != NULL
+					&& !(write && (entry->is_zero_mapped || entry->is_cow)))
+				{
+					if (write && !entry->writable)
+						return false;
+
+					/* The zero frame is never evicted. */
+					if (entry->is_zero_mapped || frame_table_pin_page (t, upage))
+						return true;
+				}
+			else if (!supp_page_table_fault (table, uaddr, esp, write))
+				return false;
+		}
+}
+
+/* Unpins the current process's page at UADDR, pinned by
+	supp_page_table_pin(). */
+void
+supp_page_table_unpin (struct hash *table, const void *uaddr)
+{
+	uint8_t *upage = pg_round_down (uaddr);
+	struct supp_page *entry = supp_page_table_find_entry (table, (uintptr_t) upage);
+
+	ASSERT (entry != NULL);
+	if (!entry->is_zero_mapped)
+		frame_table_unpin_page (thread_current (), upage);
+}
+
 /* Returns the supplemental page entry given the page table TABLE and the user virtual address VADDR to get. */
 struct supp_page *
 supp_page_table_find_entry (struct hash *table, uintptr_t vaddr)
 {
-	struct supp_page *supp_page_entry_copy;
+	struct supp_page key;
 	struct hash_elem *elem;
 
-	supp_page_entry_copy = (struct supp_page *)malloc (sizeof (struct supp_page));
-	supp_page_entry_copy->upage = vaddr;
-	elem =  hash_find (table, &supp_page_entry_copy->hash_elem);
-	free (supp_page_entry_copy);
+	key.upage = vaddr;
+	elem =  hash_find (table, &key.hash_elem);
 	if (elem == NULL)
 		return NULL;
 	else
 		return hash_entry (elem, struct supp_page, hash_elem);
 }
 
+/* Returns the entry for UPAGE in TABLE, the current process's
+	supplemental page table.  A page of one of the process's regions
+	that has not been touched yet has no entry, so one is made from the
+	region.  Returns a null pointer if UPAGE is in no region. */
+static struct supp_page *
+get_entry (struct hash *table, uintptr_t upage)
+{
+	struct supp_page *entry = supp_page_table_find_entry (table, upage);
+	struct vma *v;
+
+	if (entry != NULL)
+		return entry;
+	v = vma_find (&thread_current ()->vma_list, upage);
+	if (v == NULL)
+		return NULL;
+	return supp_page_table_insert (table, v, upage, false);
+}
+
+/* Removes the entries of region V's pages from the supplemental page
+	table TABLE of the current process, freeing their frames, after
+	writing dirty memory-mapped pages back to their file.  Only the
+	pages that were touched have entries, and only they are visited. */
+void
+supp_page_table_remove_region (struct hash *table, struct vma *v)
+{
+	while (!list_empty (&v->pages))
+		{
+			struct supp_page *entry = list_entry (list_pop_front (&v->pages),
+																						struct supp_page, vma_elem);
+
+			if (!entry->is_zero_mapped && entry->is_loaded && !entry->is_in_swap)
+				frame_table_free_frame (thread_current (), (uint8_t *) entry->upage);
+			hash_delete (table, &entry->hash_elem);
+			supp_page_table_destructor (&entry->hash_elem, NULL);
+		}
+}
+
 /* Free all the frames occupied by any process virtual address in the frame table
 	and dellocate resources for the hash table of the supplmental page table. */
 void
@@ -109,33 +258,115 @@ supp_page_table_destroy (struct hash *table)
   hash_destroy (table, supp_page_table_destructor);
 }
 
-/* Load a page of the executable file of the process from the disk.
+/* Fills TABLE, the empty supplemental page table of the current
+	process, which is being forked from PARENT, with copies of PARENT's
+	pages.  The pages themselves are shared until either process writes
+	them; the current process loads its pages from its own handle on
+	the executable.  Memory-mapped files are not inherited.  Returns
+	false if memory runs out. */
+bool
+supp_page_table_fork (struct hash *table, struct thread *parent)
+{
+	struct thread *cur = thread_current ();
+	struct hash_iterator i;
+
+	hash_first (&i, &parent->supp_page_table);
+	while (hash_next (&i))
+		{
+			struct supp_page *parent_entry = hash_entry (hash_cur (&i), struct supp_page, hash_elem);
+			struct supp_page *entry;
+			struct vma *v;
+
+			if (parent_entry->is_mmap)
+				continue;
+			entry = malloc (sizeof *entry);
+			if (entry == NULL)
+				return false;
+			frame_table_fork_page (parent, parent_entry, cur, entry);
+			if (entry->file != NULL)
+				entry->file = cur->executable;
+			hash_insert (table, &entry->hash_elem);
+			v = vma_find (&cur->vma_list, entry->upage);
+			ASSERT (v != NULL);
+			list_push_back (&v->pages, &entry->vma_elem);
+		}
+	return true;
+}
+
+/* Load a page of the process's executable or of a memory-mapped file from the disk.
+	A read-only page of the executable is shared: if another process
+	running the same executable has it in a frame, that frame is mapped
+	instead of reading the page again.  A page of the executable also
+	brings in its neighbors, see fault_around().
 	Return true if success, false otherwise. */
 static bool
-supp_page_table_load_page (struct hash *table, struct supp_page *entry)
+supp_page_table_load_page (struct hash *table, struct supp_page *entry, bool write)
 {
 	struct thread *thread_cur;
-	uint8_t *upage;
+
+	thread_cur = thread_current ();
+
+	/* A page of zeros that is only being read maps the shared zero frame. */
+	if (entry->page_read_bytes == 0 && !entry->is_mmap && !write)
+		{
+			if (!pagedir_set_page (thread_cur->pagedir, (void *) entry->upage, frame_table_zero_frame (), false))
+				return false;
+			entry->is_zero_mapped = true;
+			entry->is_loaded = true;
+			return true;
+		}
+
+	/* Map another process's copy of a read-only page of the executable,
+		or else read the page. */
+	if (!map_shared_page (entry) && !read_page (entry))
+		return false;
+
+	if (!entry->is_mmap && entry->page_read_bytes > 0)
+		fault_around (table, entry);
+	return true;
+}
+
+/* Maps another process's copy of ENTRY's page, if it is a read-only
+	page of the executable that some process has in a frame.  Returns
+	true if successful. */
+static bool
+map_shared_page (struct supp_page *entry)
+{
+	if (entry->writable || entry->is_mmap
+			|| !frame_table_map_shared (thread_current (), (uint8_t *) entry->upage,
+																	file_get_inode (entry->file), entry->offset))
+		return false;
+	entry->is_loaded = true;
+	return true;
+}
+
+/* Reads ENTRY's page from its file into a new frame.  Returns true if
+	successful, false if the file is too short. */
+static bool
+read_page (struct supp_page *entry)
+{
+	struct thread *thread_cur = thread_current ();
 	uint8_t *kpage;
 	int index;
 
-	thread_cur = thread_current ();
-  upage = entry->upage;
-  
   /* Get a page of memory and pin it for loading in the executable. */
-  index = frame_table_assign_frame (thread_cur, entry->upage, entry->writable, true);
-	kpage = pagedir_get_page (thread_cur->pagedir, entry->upage);
-  file_seek (thread_cur->executable, entry->offset);
+  index = frame_table_assign_frame (thread_cur, (uint8_t *) entry->upage, entry->writable, true);
+	kpage = pagedir_get_page (thread_cur->pagedir, (void *) entry->upage);
 
   /* Load the executable to the page. */
-  if (file_read (thread_cur->executable, kpage, entry->page_read_bytes) != (int) entry->page_read_bytes)
+  if (entry->page_read_bytes > 0
+      && file_read_at (entry->file, kpage, entry->page_read_bytes, entry->offset) != (int) entry->page_read_bytes)
     {
-    	exit (-1);
+      frame_table_unpin_frame (index);
+      frame_table_free_frame (thread_cur, (uint8_t *) entry->upage);
       return false;
     }
 
-  /* Set the remaining unload bytes of the page to 0. */
-  memset (kpage + entry->page_read_bytes, 0,  PGSIZE - entry->page_read_bytes);
+  /* The rest of the page is already zeroed, like every new frame. */
+
+  /* Let other processes running the executable map the page. */
+  if (!entry->writable && !entry->is_mmap)
+    frame_table_share_frame (index, file_get_inode (entry->file), entry->offset);
 
   /* Unpin the frame after finish loading. */
   frame_table_unpin_frame (index);
@@ -143,20 +374,130 @@ supp_page_table_load_page (struct hash *table, struct supp_page *entry)
   /* Set the supplmental page entry to loaded. */
   entry->is_loaded = true;
 	return true;
+}
+
+/* Loads ENTRY's page of the executable into a new frame from DATA,
+	which holds the page's data as read from the file. */
+static void
+install_read_page (struct supp_page *entry, const uint8_t *data)
+{
+	struct thread *thread_cur = thread_current ();
+	uint8_t *kpage;
+	int index;
+
+	index = frame_table_assign_frame (thread_cur, (uint8_t *) entry->upage, entry->writable, true);
+	kpage = pagedir_get_page (thread_cur->pagedir, (void *) entry->upage);
+	memcpy (kpage, data, entry->page_read_bytes);
+	if (!entry->writable)
+		frame_table_share_frame (index, file_get_inode (entry->file), entry->offset);
+	frame_table_unpin_frame (index);
+	entry->is_loaded = true;
+}
+
+/* Maps the other pages of the executable in the fault_around_pages
+	window around ENTRY's page, which was just loaded, that hold data
+	from the same region of the file.  Pages that another process has in
+	a frame are just mapped.  The others are read, each run of them
+	with a single read since their data is contiguous in the file, but
+	only while frames are free, so that nothing is evicted for a page
+	that may never be used.  The pages are left not accessed, so the
+	clock evicts them first if they turn out not to be needed. */
+static void
+fault_around (struct hash *table, struct supp_page *entry)
+{
+	uintptr_t window = fault_around_pages * PGSIZE;
+	uintptr_t start, end, upage;
+	uintptr_t run_start = 0;
+	size_t run_cnt = 0;
+	size_t spare;
+	struct vma *v;
+
+	if (fault_around_pages <= 1)
+		return;
+	v = vma_find (&thread_current ()->vma_list, entry->upage);
+	if (v == NULL)
+		return;
+
+	start = entry->upage - entry->upage % window;
+	end = start + window;
+	if (start < v->start)
+		start = v->start;
+	if (end > v->end || end < start)
+		end = v->end;
+
+	/* Collect runs of pages to read, mapping shared pages on the way. */
+	spare = frame_table_spare_frames ();
+	for (upage = start; upage < end; upage += PGSIZE)
+		{
+			struct supp_page *e = NULL;
+			size_t page_read_bytes;
+			off_t offset;
+
+			vma_page (v, upage, &offset, &page_read_bytes);
+			if (upage != entry->upage && page_read_bytes > 0)
+				e = get_entry (table, upage);
+			if (e != NULL && (e->is_loaded || e->is_in_swap || e->is_anon
+												|| e->page_read_bytes == 0 || map_shared_page (e)))
+				e = NULL;
+			if (e != NULL && spare > 0)
+				{
+					if (run_cnt++ == 0)
+						run_start = upage;
+					spare--;
+					continue;
+				}
+
+			/* The run, if any, ends here. */
+			if (run_cnt > 0)
+				read_run (table, run_start, run_cnt);
+			run_cnt = 0;
+			if (e != NULL)
+				return;
+		}
+	if (run_cnt > 0)
+		read_run (table, run_start, run_cnt);
+}
 
+/* Reads the PAGE_CNT pages of the executable from START on, which
+	have entries in TABLE and whose data follows each other in the
+	file, with one read into a kernel buffer, and loads them from it.
+	Pages are only prefetched, so nothing is loaded if the buffer can't
+	be had or the read fails. */
+static void
+read_run (struct hash *table, uintptr_t start, size_t page_cnt)
+{
+	struct supp_page *first = supp_page_table_find_entry (table, start);
+	struct supp_page *last = supp_page_table_find_entry (table, start + (page_cnt - 1) * PGSIZE);
+	off_t size = (page_cnt - 1) * PGSIZE + last->page_read_bytes;
+	uint8_t *buffer;
+	size_t i;
+
+	buffer = palloc_get_multiple (0, page_cnt);
+	if (buffer == NULL)
+		return;
+	if (inode_read_uncached (file_get_inode (first->file), buffer, size, first->offset) == size)
+		for (i = 0; i < page_cnt; i++)
+			install_read_page (supp_page_table_find_entry (table, start + i * PGSIZE),
+												 buffer + i * PGSIZE);
+	palloc_free_multiple (buffer, page_cnt);
 }
 
 /* Destructs the hash table of the supplemental page table. */
 static void
-supp_page_table_destructor (struct hash_elem *e, void *aux)
+supp_page_table_destructor (struct hash_elem *e, void *aux UNUSED)
 {
 	struct supp_page *entry;
 
 	entry = hash_entry (e, struct supp_page, hash_elem);
-	if (entry->is_in_swap)
+	if (entry->has_swap_slot)
 		{
 			swap_table_free (entry->block_page_idx);
 		}
+	if (entry->is_zero_mapped)
+		{
+			/* Don't let pagedir_destroy() free the shared zero frame. */
+			pagedir_clear_page (thread_current ()->pagedir, (void *) entry->upage);
+		}
 	free (entry);
 }
 
@@ -187,9 +528,52 @@ swap_in_page_from_disk (struct supp_page* entry)
 {
 	int index;
 	/* Get a frame for the page in the swap disk and pin it for getting data from the swap table to the main memory. */
-	index = frame_table_assign_frame (thread_current(), entry->upage, entry->writable, true);
+	index = frame_table_assign_frame (thread_current(), (uint8_t *) entry->upage, entry->writable, true);
 	entry->is_in_swap = false;
-	swap_table_swap_in (entry->block_page_idx, entry->upage);
+	swap_table_swap_in (entry->block_page_idx,
+											pagedir_get_page (thread_current ()->pagedir, (void *) entry->upage));
 	/* Unpin the page after data has transferred. */
 	frame_table_unpin_frame (index);
 }
+
+/* Returns true if an access to FAULT_ADDR with user stack pointer ESP
+	looks like a push onto the stack: at most 32 bytes below ESP (PUSHA
+	checks that far down before moving ESP) and within the stack limit. */
+static bool
+is_stack_access (const void *fault_addr, const void *esp)
+{
+	uintptr_t addr = (uintptr_t) fault_addr;
+
+	return (addr + 32 >= (uintptr_t) esp
+					&& addr >= (uintptr_t) PHYS_BASE - stack_page_limit * PGSIZE);
+}
+
+/* Extends the current process's stack region down to UPAGE, and
+	adds a page of zeros there, which the process is about to write if
+	WRITE is true.  Fails if another region is in the way. */
+static bool
+grow_stack (struct hash *table, uintptr_t upage, bool write)
+{
+	struct list *vma_list = &thread_current ()->vma_list;
+	struct vma *stack = vma_find_type (vma_list, VMA_STACK);
+
+	if (stack == NULL || upage >= stack->start
+			|| vma_overlaps (vma_list, upage, stack->start))
+		return false;
+	stack->start = upage;
+	return get_entry (table, upage) != NULL
+		&& supp_page_table_inspect (table, upage, write);
+}
+
+/* Replaces ENTRY's mapping of the shared zero frame by a zeroed frame
+	of its own, writable.  New frames are always zeroed. */
+static bool
+unshare_zero_page (struct supp_page *entry)
+{
+	struct thread *thread_cur = thread_current ();
+
+	pagedir_clear_page (thread_cur->pagedir, (void *) entry->upage);
+	entry->is_zero_mapped = false;
+	frame_table_assign_frame (thread_cur, (uint8_t *) entry->upage, true, false);
+	return true;
+}
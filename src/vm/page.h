@@ -1,27 +1,57 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
 #include <hash.h>
+#include <list.h>
 #include "filesys/off_t.h"
 
+struct thread;
+struct vma;
+
 struct supp_page
   {
     struct hash_elem hash_elem; 		/* Hash table element. */
+    struct list_elem vma_elem;          /* Element in its region's list of pages. */
     uintptr_t upage;					/* Address of the page. */
     bool is_in_swap;					/* Indicates if the page is in the swap disk */
     bool is_loaded;						/* Indicates if the page has been loaded from the filesys. */
     bool writable;						/* Indicates if the page is writable. */
     bool is_stack;                      /* Indicates if the page is allocated for the stack. */
+    bool is_mmap;                       /* Indicates if the page belongs to a memory-mapped file. */
+    struct file *file;                  /* File to load the page from, if any. */
     size_t page_read_bytes;				/* Number of bytes to read when the page is loaded. */
     off_t offset;						/* Offset of the executable that should be read when load. */
+    bool is_zero_mapped;                /* Indicates if the page maps the shared zero frame, read-only. */
+    bool is_cow;                        /* Indicates if the page is mapped read-only, shared with a forked process, and copied on write. */
+    bool is_anon;                       /* Indicates if the page's data can only be kept in swap, not reread from FILE. */
+    bool has_swap_slot;                 /* Indicates if BLOCK_PAGE_IDX holds a copy of the page. */
     uint32_t block_page_idx;			/* The possible page index in the block device if the page is swapped in. */
   };
 
-/* Function declarations. */
-void supp_page_table_init (struct hash *table);
-bool supp_page_table_inspect (struct hash *table, uintptr_t vaddr);
-void supp_page_table_insert (struct hash *table, uintptr_t upage, size_t page_read_bytes, bool writable, off_t offset, bool is_stack);
-void supp_page_table_destroy (struct hash *table);
-struct supp_page* supp_page_table_find_entry (struct hash *table, uintptr_t vaddr);
+/* Default maximum size of a process's stack, in pages (8 MB). */
+#define STACK_PAGE_LIMIT_DEFAULT 2048
 
+/* Maximum size of a process's stack, in pages.  Set with -sl. */
+extern size_t stack_page_limit;
 
+/* Default number of executable pages mapped by one page fault. */
+#define FAULT_AROUND_DEFAULT 8
 
+/* Number of executable pages mapped by one page fault, in an aligned
+	window around the faulting page.  1 turns fault-around off.  Set
+	with -fa. */
+extern size_t fault_around_pages;
 
+/* Function declarations. */
+void supp_page_table_init (struct hash *table);
+bool supp_page_table_inspect (struct hash *table, uintptr_t vaddr, bool write);
+bool supp_page_table_fault (struct hash *table, const void *fault_addr, const void *esp, bool write);
+bool supp_page_table_pin (struct hash *table, const void *uaddr, const void *esp, bool write);
+void supp_page_table_unpin (struct hash *table, const void *uaddr);
+struct supp_page *supp_page_table_insert (struct hash *table, struct vma *v, uintptr_t upage, bool is_stack);
+void supp_page_table_remove_region (struct hash *table, struct vma *v);
+void supp_page_table_destroy (struct hash *table);
+bool supp_page_table_fork (struct hash *table, struct thread *parent);
+struct supp_page* supp_page_table_find_entry (struct hash *table, uintptr_t vaddr);
 
+#endif /* vm/page.h */
@@ -2,12 +2,18 @@
 #include <hash.h>
 #include <bitmap.h>
 #include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
 #include "frame.h"
 #include "page.h"
 #include "swap.h"
+#include "zswap.h"
 
-#define SWAP_BLOCK_PAGE_NUM 1024
-#define SECTORS_PER_PAGE 8
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Number of consecutive slots that swap-out fills in order before
+	looking for another run of free slots. */
+#define SWAP_CLUSTER_PAGES 16
 
 /* Swap block device. */
 struct block *swap_block;
@@ -16,72 +22,99 @@ struct block *swap_block;
 or not in the swap block device). */
 struct bitmap *swap_table;
 
+/* Number of page slots in the swap block device. */
+static size_t swap_page_cnt;
+
+/* Number of pages that refer to each slot in use.  A process and the
+	children it forks share the slots of the pages they had swapped
+	out or had a clean copy of in swap at the time of the fork. */
+static uint16_t *slot_refs;
+
+/* Slots of the current cluster not handed out yet, from cluster_next
+	up to cluster_end. */
+static size_t cluster_next;
+static size_t cluster_end;
+
+/* Where the next search for free slots starts. */
+static size_t scan_next;
+
 /* Lock for the swap table. */
 static struct lock swap_table_lock;
 
 /* Function declaration. */
-static uint32_t swap_table_get_free_page ();
+static uint32_t swap_table_get_free_page (void);
+static size_t scan_free (size_t cnt);
 
 /* Initialize the swap table. */
 void
-swap_table_init ()
+swap_table_init (void)
 {
 	lock_init (&swap_table_lock);
 	swap_block = block_get_role (BLOCK_SWAP);
-	swap_table = bitmap_create (SWAP_BLOCK_PAGE_NUM);
+	swap_page_cnt = swap_block != NULL ? block_size (swap_block) / SECTORS_PER_PAGE : 0;
+	swap_table = bitmap_create (swap_page_cnt);
+	slot_refs = calloc (swap_page_cnt, sizeof *slot_refs);
+	if (swap_table == NULL || (slot_refs == NULL && swap_page_cnt > 0))
+		PANIC ("Not enough memory for the swap table.");
+	cluster_next = cluster_end = scan_next = 0;
 }
 
-/* Gets page from swap disk */
+/* Gets page from the compressed store or else from swap disk.  The
+	slot stays allocated, so the page can be dropped again without a
+	write as long as it stays clean.
+	The transfer runs without swap_table_lock, which only guards the
+	slot bookkeeping, so transfers for different pages can overlap. */
 void
 swap_table_swap_in (uint32_t idx, void *upage)
 {
-	int i;
-	block_sector_t sector_idx;
-
-	lock_acquire (&swap_table_lock);
-
-	/* Read 8 blocks, which is a page. */
-	sector_idx = idx * SECTORS_PER_PAGE;
-	for (i = 0; i < SECTORS_PER_PAGE; ++i)
-		{
-			block_read (swap_block, sector_idx + i, upage);
-			upage += BLOCK_SECTOR_SIZE;
-		}
-
-	/* Set the bits of the swap table to unused after swapping out. */
-	bitmap_set (swap_table, idx, false);
-	lock_release (&swap_table_lock);
+	if (!zswap_load (idx, upage))
+			block_read_multiple (swap_block, idx * SECTORS_PER_PAGE, SECTORS_PER_PAGE, upage);
 }
 
 /* Stores page UPAGE in swap disk. Returns the page index stored in the block device. */
 uint32_t
 swap_table_swap_out (const void *upage)
 {
-	int i;
 	uint32_t block_page_idx;
-	block_sector_t sector_idx;
 
 	lock_acquire (&swap_table_lock);
-
 	block_page_idx = swap_table_get_free_page ();
-	sector_idx = block_page_idx * SECTORS_PER_PAGE;
-	for (i = 0; i < SECTORS_PER_PAGE; ++i)
-		{
-			block_write (swap_block, sector_idx + i, upage);
-			upage += BLOCK_SECTOR_SIZE;
-		}
-
-	/* Set the bits of the swap table to used after swapping out. */
-	bitmap_set (swap_table, block_page_idx, true);
 	lock_release (&swap_table_lock);
 
+	/* Keep the page compressed in memory if there is room, otherwise write it out. */
+	if (!zswap_store (block_page_idx, upage))
+		block_write_multiple (swap_block, block_page_idx * SECTORS_PER_PAGE, SECTORS_PER_PAGE, upage);
 	return block_page_idx;
 }
 
-/* Free a page in the swap table. */
+/* Adds a reference to the slot at INDEX, for another page that has
+	a copy of the same data there. */
+void
+swap_table_dup (uint32_t index)
+{
+	lock_acquire (&swap_table_lock);
+	ASSERT (slot_refs[index] > 0 && slot_refs[index] < UINT16_MAX);
+	slot_refs[index]++;
+	lock_release (&swap_table_lock);
+}
+
+/* Drops a reference to the slot at INDEX, freeing the slot once no
+	page refers to it. */
 void
 swap_table_free (uint32_t index)
 {
+	bool last;
+
+	lock_acquire (&swap_table_lock);
+	ASSERT (slot_refs[index] > 0);
+	last = --slot_refs[index] == 0;
+	lock_release (&swap_table_lock);
+	if (!last)
+		return;
+
+	/* Nothing refers to the slot now, so nothing can reach the
+		compressed copy before the slot is handed out again. */
+	zswap_invalidate (index);
 	lock_acquire (&swap_table_lock);
 	bitmap_set (swap_table, index, false);
 	lock_release (&swap_table_lock);
@@ -89,29 +122,73 @@ swap_table_free (uint32_t index)
 
 /* Destroy the swap table. */
 void
-swap_table_destroy ()
+swap_table_destroy (void)
 {
 	bitmap_destroy (swap_table); 
+	free (slot_refs);
 }
 
-/* Obtain a free page space from the swap disk.
+/* Obtain a free page space from the swap disk and mark it used.
+	Slots are handed out in order from a cluster of free slots, so
+	consecutive swap-outs go to consecutive sectors; a new cluster is
+	searched for starting where the last one was found.
 	Return the page index of the disk.
 	Panic the kernel if the swap disk is full already.
 	*/
 static uint32_t
-swap_table_get_free_page ()
+swap_table_get_free_page (void)
 {
-	int i;
+	size_t idx;
 
-	for (i = 0; i < SWAP_BLOCK_PAGE_NUM; ++i)
+	/* Take the next slot of the current cluster, unless a single-slot
+		allocation below already took it. */
+	while (cluster_next < cluster_end)
 		{
-			if (!bitmap_test (swap_table, i))
+			idx = cluster_next++;
+			if (!bitmap_test (swap_table, idx))
 				{
-					return i;
+					bitmap_mark (swap_table, idx);
+					slot_refs[idx] = 1;
+					return idx;
 				}
 		}
-		/* Panic kernel is there is no more space to swap to the disk. */
-		PANIC ("Swap table is full!");
-		return -1;
+
+	/* Start a new cluster. */
+	idx = scan_free (SWAP_CLUSTER_PAGES);
+	if (idx != BITMAP_ERROR)
+		{
+			cluster_next = idx + 1;
+			cluster_end = idx + SWAP_CLUSTER_PAGES;
+			scan_next = cluster_end;
+			bitmap_mark (swap_table, idx);
+			slot_refs[idx] = 1;
+			return idx;
+		}
+
+	/* No free cluster is left: settle for any free slot. */
+	idx = scan_free (1);
+	if (idx != BITMAP_ERROR)
+		{
+			scan_next = idx + 1;
+			bitmap_mark (swap_table, idx);
+			slot_refs[idx] = 1;
+			return idx;
+		}
+
+	/* Panic kernel is there is no more space to swap to the disk. */
+	PANIC ("Swap table is full!");
+	return -1;
 }
 
+/* Returns the first index of CNT consecutive free slots, searching
+	from scan_next to the end of the swap table and then from the
+	start, or BITMAP_ERROR if there are none. */
+static size_t
+scan_free (size_t cnt)
+{
+	size_t idx = bitmap_scan (swap_table, scan_next, cnt, false);
+
+	if (idx == BITMAP_ERROR && scan_next > 0)
+		idx = bitmap_scan (swap_table, 0, cnt, false);
+	return idx;
+}
@@ -1,9 +1,14 @@
-#include <bitmap.h>
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdint.h>
 
 /* Function declaractions. */
-void swap_table_init ();
+void swap_table_init (void);
 void swap_table_swap_in (uint32_t idx, void *upage);
 uint32_t swap_table_swap_out (const void *upage);
+void swap_table_dup (uint32_t index);
 void swap_table_free (uint32_t index);
-void swap_table_destroy ();
+void swap_table_destroy (void);
 
+#endif /* vm/swap.h */
@@ -0,0 +1,159 @@
+#include "vm/vma.h"
+#include <debug.h>
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+/* Each process keeps its regions in vma_list, sorted by address
+   and never overlapping.  A process has only a handful of regions
+   (code, data, stack and a few mappings), so a list is fast
+   enough. */
+
+/* Adds a region from START to END, both page-aligned, to LIST.
+   FILE's data from OFFSET on fills the first READ_BYTES bytes of
+   the region and zeros fill the rest.  Returns the new region, or
+   a null pointer if it would overlap another region or memory
+   runs out. */
+struct vma *
+vma_add (struct list *list, uintptr_t start, uintptr_t end,
+         enum vma_type type, bool writable, struct file *file,
+         off_t offset, size_t read_bytes)
+{
+  struct vma *v;
+  struct list_elem *e;
+
+  ASSERT (start % PGSIZE == 0 && end % PGSIZE == 0);
+  ASSERT (start < end);
+
+  if (vma_overlaps (list, start, end))
+    return NULL;
+  v = malloc (sizeof *v);
+  if (v == NULL)
+    return NULL;
+  v->start = start;
+  v->end = end;
+  v->type = type;
+  v->writable = writable;
+  v->file = file;
+  v->offset = offset;
+  v->read_bytes = read_bytes;
+  list_init (&v->pages);
+
+  for (e = list_begin (list); e != list_end (list); e = list_next (e))
+    if (list_entry (e, struct vma, elem)->start > start)
+      break;
+  list_insert (e, &v->elem);
+  return v;
+}
+
+/* Returns the region in LIST that contains ADDR, or a null pointer
+   if there is none. */
+struct vma *
+vma_find (struct list *list, uintptr_t addr)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (list); e != list_end (list); e = list_next (e))
+    {
+      struct vma *v = list_entry (e, struct vma, elem);
+      if (addr < v->start)
+        break;
+      if (addr < v->end)
+        return v;
+    }
+  return NULL;
+}
+
+/* Returns the first region in LIST of the given TYPE, or a null
+   pointer if there is none. */
+struct vma *
+vma_find_type (struct list *list, enum vma_type type)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (list); e != list_end (list); e = list_next (e))
+    {
+      struct vma *v = list_entry (e, struct vma, elem);
+      if (v->type == type)
+        return v;
+    }
+  return NULL;
+}
+
+/* Returns true if any region in LIST overlaps START...END. */
+bool
+vma_overlaps (struct list *list, uintptr_t start, uintptr_t end)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (list); e != list_end (list); e = list_next (e))
+    {
+      struct vma *v = list_entry (e, struct vma, elem);
+      if (v->start >= end)
+        break;
+      if (v->end > start)
+        return true;
+    }
+  return false;
+}
+
+/* Stores into *OFFSET and *PAGE_READ_BYTES where the data of page
+   UPAGE of region V comes from in V's file and how much of it
+   there is. */
+void
+vma_page (const struct vma *v, uintptr_t upage,
+          off_t *offset, size_t *page_read_bytes)
+{
+  size_t page_ofs = upage - v->start;
+
+  ASSERT (upage >= v->start && upage < v->end);
+
+  if (page_ofs >= v->read_bytes)
+    {
+      *offset = v->offset + v->read_bytes;
+      *page_read_bytes = 0;
+    }
+  else
+    {
+      size_t left = v->read_bytes - page_ofs;
+      *offset = v->offset + page_ofs;
+      *page_read_bytes = left < PGSIZE ? left : PGSIZE;
+    }
+}
+
+/* Removes region V from its list and frees it. */
+void
+vma_remove (struct vma *v)
+{
+  list_remove (&v->elem);
+  free (v);
+}
+
+/* Adds a copy of each region in SRC other than a memory-mapped file
+   to DST, which must be empty, with FILE in place of the
+   executable.  Returns false if memory runs out. */
+bool
+vma_copy (struct list *dst, struct list *src, struct file *file)
+{
+  struct list_elem *e;
+
+  ASSERT (list_empty (dst));
+
+  for (e = list_begin (src); e != list_end (src); e = list_next (e))
+    {
+      struct vma *v = list_entry (e, struct vma, elem);
+      if (v->type != VMA_MMAP
+          && vma_add (dst, v->start, v->end, v->type, v->writable,
+                      v->file != NULL ? file : NULL, v->offset,
+                      v->read_bytes) == NULL)
+        return false;
+    }
+  return true;
+}
+
+/* Frees every region in LIST. */
+void
+vma_destroy (struct list *list)
+{
+  while (!list_empty (list))
+    free (list_entry (list_pop_front (list), struct vma, elem));
+}
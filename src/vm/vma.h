@@ -0,0 +1,50 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+/* Kinds of regions. */
+enum vma_type
+  {
+    VMA_CODE,                           /* Read-only executable segment. */
+    VMA_DATA,                           /* Writable executable segment. */
+    VMA_STACK,                          /* User stack. */
+    VMA_MMAP                            /* Memory-mapped file. */
+  };
+
+/* A region of a process's address space whose pages are all alike:
+   each holds the next page of FILE's data, if any, followed by
+   zeros.  Pages of a region only get a supplemental page table
+   entry when they are first touched; the region keeps a list of
+   those entries, so that it can be torn down without visiting its
+   untouched pages. */
+struct vma
+  {
+    struct list_elem elem;              /* Element in thread's vma_list. */
+    uintptr_t start;                    /* First page. */
+    uintptr_t end;                      /* End of the last page. */
+    enum vma_type type;                 /* Kind of region. */
+    bool writable;                      /* May the process write it? */
+    struct file *file;                  /* File the data comes from, if any. */
+    off_t offset;                       /* Offset of the data in FILE. */
+    size_t read_bytes;                  /* Bytes of data; the rest is zeros. */
+    struct list pages;                  /* Pages with entries, as struct supp_page. */
+  };
+
+struct vma *vma_add (struct list *, uintptr_t start, uintptr_t end,
+                     enum vma_type, bool writable, struct file *,
+                     off_t offset, size_t read_bytes);
+struct vma *vma_find (struct list *, uintptr_t addr);
+struct vma *vma_find_type (struct list *, enum vma_type);
+bool vma_overlaps (struct list *, uintptr_t start, uintptr_t end);
+void vma_page (const struct vma *, uintptr_t upage,
+               off_t *offset, size_t *page_read_bytes);
+void vma_remove (struct vma *);
+bool vma_copy (struct list *dst, struct list *src, struct file *file);
+void vma_destroy (struct list *);
+
+#endif /* vm/vma.h */
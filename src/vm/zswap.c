@@ -0,0 +1,300 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Compressed store for swapped-out pages.
+
+   A page being swapped out is compressed and, if the result is
+   small enough and there is room, kept in memory under the swap
+   slot allocated for it instead of being written to the swap
+   disk.  Swapping the page in decompresses it.  The slot stays
+   allocated either way, so a page can move to disk later without
+   running out of swap space.
+
+   Pages are compressed with a small LZ77 codec.  The compressed
+   data is a sequence of runs, each introduced by a control byte C:
+   if C < 0x80, C + 1 literal bytes follow; otherwise C - 0x80 +
+   LZ_MIN_MATCH bytes are copied from LZ_OFFSET bytes back in the
+   output, where LZ_OFFSET is given by the next two bytes, least
+   significant first. */
+
+#define LZ_MIN_MATCH 3                  /* Shortest match worth coding. */
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH) /* Longest match. */
+#define LZ_MAX_LITERALS 0x80            /* Longest literal run. */
+#define LZ_HASH_BITS 12                 /* Log2 of match table size. */
+#define LZ_NO_MATCH 0xffff              /* Empty match table entry. */
+
+/* A page is kept only if it compresses to this size or less. */
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4)
+
+/* A compressed page. */
+struct zswap_entry
+  {
+    struct hash_elem elem;              /* Element in zswap_pages. */
+    uint32_t slot;                      /* Swap slot. */
+    size_t size;                        /* Bytes of compressed data. */
+    uint8_t data[];                     /* Compressed data. */
+  };
+
+size_t zswap_page_limit;
+
+/* Compressed pages, by swap slot, and the bytes they occupy. */
+static struct hash zswap_pages;
+static size_t zswap_bytes;
+static struct lock zswap_lock;
+
+/* Most recent position of each hashed 3-byte sequence, for the
+   compressor.  Guarded by lz_lock. */
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+static struct lock lz_lock;
+
+static hash_hash_func entry_hash;
+static hash_less_func entry_less;
+static struct zswap_entry *find_entry (uint32_t slot);
+static size_t lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_max);
+static bool lz_decompress (const uint8_t *src, size_t src_size, uint8_t *dst);
+
+/* Initializes the compressed store. */
+void
+zswap_init (void)
+{
+  hash_init (&zswap_pages, entry_hash, entry_less, NULL);
+  zswap_bytes = 0;
+  lock_init (&zswap_lock);
+  lock_init (&lz_lock);
+}
+
+/* Tries to keep a compressed copy of PAGE for swap slot SLOT.
+   Returns true if successful, false if the store is turned off or
+   full, or if PAGE doesn't compress well, in which case the caller
+   must write PAGE to the swap disk. */
+bool
+zswap_store (uint32_t slot, const void *page)
+{
+  struct zswap_entry *e;
+  uint8_t *buf;
+  size_t size;
+
+  if (zswap_page_limit == 0)
+    return false;
+
+  buf = malloc (ZSWAP_MAX_SIZE);
+  if (buf == NULL)
+    return false;
+  lock_acquire (&lz_lock);
+  size = lz_compress (page, buf, ZSWAP_MAX_SIZE);
+  lock_release (&lz_lock);
+
+  e = size > 0 ? malloc (sizeof *e + size) : NULL;
+  if (e != NULL)
+    {
+      e->slot = slot;
+      e->size = size;
+      memcpy (e->data, buf, size);
+
+      lock_acquire (&zswap_lock);
+      if (zswap_bytes + size <= zswap_page_limit * PGSIZE)
+        {
+          zswap_bytes += size;
+          hash_insert (&zswap_pages, &e->elem);
+        }
+      else
+        {
+          free (e);
+          e = NULL;
+        }
+      lock_release (&zswap_lock);
+    }
+  free (buf);
+  return e != NULL;
+}
+
+/* Decompresses the page kept for swap slot SLOT into PAGE.
+   Returns true if successful, false if the store has no copy of
+   the page, in which case it is on the swap disk.  The copy stays
+   in the store until the slot is freed. */
+bool
+zswap_load (uint32_t slot, void *page)
+{
+  struct zswap_entry *e;
+  bool ok;
+
+  if (zswap_page_limit == 0)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  e = find_entry (slot);
+  ok = e != NULL;
+  if (ok && !lz_decompress (e->data, e->size, page))
+    PANIC ("zswap: corrupt page for swap slot %"PRIu32, slot);
+  lock_release (&zswap_lock);
+  return ok;
+}
+
+/* Drops the page kept for swap slot SLOT, if any. */
+void
+zswap_invalidate (uint32_t slot)
+{
+  struct zswap_entry *e;
+
+  if (zswap_page_limit == 0)
+    return;
+
+  lock_acquire (&zswap_lock);
+  e = find_entry (slot);
+  if (e != NULL)
+    {
+      hash_delete (&zswap_pages, &e->elem);
+      zswap_bytes -= e->size;
+    }
+  lock_release (&zswap_lock);
+  free (e);
+}
+
+/* Returns the entry for SLOT, or a null pointer if there is none.
+   zswap_lock must be held. */
+static struct zswap_entry *
+find_entry (uint32_t slot)
+{
+  struct zswap_entry key;
+  struct hash_elem *e;
+
+  key.slot = slot;
+  e = hash_find (&zswap_pages, &key.elem);
+  return e != NULL ? hash_entry (e, struct zswap_entry, elem) : NULL;
+}
+
+/* Returns a hash value for entry E. */
+static unsigned
+entry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct zswap_entry *z = hash_entry (e, struct zswap_entry, elem);
+  return hash_int (z->slot);
+}
+
+/* Returns true if entry A precedes entry B. */
+static bool
+entry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct zswap_entry *a = hash_entry (a_, struct zswap_entry, elem);
+  const struct zswap_entry *b = hash_entry (b_, struct zswap_entry, elem);
+  return a->slot < b->slot;
+}
+
+/* Returns the match table index for the 3 bytes at P. */
+static inline unsigned
+lz_hash (const uint8_t *p)
+{
+  uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Compresses the page at SRC into DST, which has room for DST_MAX
+   bytes.  Returns the compressed size, or 0 if it would exceed
+   DST_MAX.  lz_lock must be held. */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_max)
+{
+  size_t ip = 0;                /* Next input byte to code. */
+  size_t lit = 0;               /* Start of pending literals. */
+  size_t op = 0;                /* Output size so far. */
+
+  memset (lz_table, 0xff, sizeof lz_table);
+  while (ip + LZ_MIN_MATCH <= PGSIZE)
+    {
+      unsigned h = lz_hash (src + ip);
+      size_t ref = lz_table[h];
+      size_t len;
+
+      lz_table[h] = ip;
+      if (ref == LZ_NO_MATCH || memcmp (src + ref, src + ip, LZ_MIN_MATCH))
+        {
+          ip++;
+          continue;
+        }
+
+      len = LZ_MIN_MATCH;
+      while (ip + len < PGSIZE && len < LZ_MAX_MATCH
+             && src[ref + len] == src[ip + len])
+        len++;
+
+      /* Emit the pending literals, then the match. */
+      while (lit < ip)
+        {
+          size_t n = ip - lit < LZ_MAX_LITERALS ? ip - lit : LZ_MAX_LITERALS;
+          if (op + 1 + n > dst_max)
+            return 0;
+          dst[op++] = n - 1;
+          memcpy (dst + op, src + lit, n);
+          op += n;
+          lit += n;
+        }
+      if (op + 3 > dst_max)
+        return 0;
+      dst[op++] = 0x80 + (len - LZ_MIN_MATCH);
+      dst[op++] = (ip - ref) & 0xff;
+      dst[op++] = (ip - ref) >> 8;
+      ip += len;
+      lit = ip;
+    }
+
+  /* Emit the trailing literals. */
+  while (lit < PGSIZE)
+    {
+      size_t n = PGSIZE - lit < LZ_MAX_LITERALS ? PGSIZE - lit : LZ_MAX_LITERALS;
+      if (op + 1 + n > dst_max)
+        return 0;
+      dst[op++] = n - 1;
+      memcpy (dst + op, src + lit, n);
+      op += n;
+      lit += n;
+    }
+  return op;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC into the page at DST.
+   Returns true if they decode to exactly one page. */
+static bool
+lz_decompress (const uint8_t *src, size_t src_size, uint8_t *dst)
+{
+  size_t ip = 0;
+  size_t op = 0;
+
+  while (ip < src_size)
+    {
+      uint8_t c = src[ip++];
+
+      if (c < 0x80)
+        {
+          size_t n = c + 1;
+          if (ip + n > src_size || op + n > PGSIZE)
+            return false;
+          memcpy (dst + op, src + ip, n);
+          ip += n;
+          op += n;
+        }
+      else
+        {
+          size_t len = c - 0x80 + LZ_MIN_MATCH;
+          size_t offset;
+
+          if (ip + 2 > src_size)
+            return false;
+          offset = src[ip] | (src[ip + 1] << 8);
+          ip += 2;
+          if (offset == 0 || offset > op || op + len > PGSIZE)
+            return false;
+
+          /* Byte by byte, since the match may overlap its own output. */
+          for (; len > 0; len--, op++)
+            dst[op] = dst[op - offset];
+        }
+    }
+  return op == PGSIZE;
+}
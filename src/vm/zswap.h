@@ -0,0 +1,17 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Most memory, in pages, that compressed swapped-out pages may
+   occupy.  0 turns the compressed store off.  Set with -zswap. */
+extern size_t zswap_page_limit;
+
+void zswap_init (void);
+bool zswap_store (uint32_t slot, const void *page);
+bool zswap_load (uint32_t slot, void *page);
+void zswap_invalidate (uint32_t slot);
+
+#endif /* vm/zswap.h */